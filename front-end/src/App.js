@@ -1,16 +1,96 @@
-import React, { useState, useRef } from "react";
+import React, { useState, useRef, useEffect } from "react";
 import { SplitPane } from "@rexxars/react-split-pane";
 import "./App.css";
 import ParseTree from "./ParseTree"; // ✅ Parse tree visual component
 import { extractParseTreeFromOutput } from "./extractParseTree"; // ✅ Extract JSON tree
 
+const COMPILER_URL = "https://custom-compiler-wkpy.onrender.com";
+const utf8 = new TextEncoder();
+
+// The single changed range between two texts, in UTF-8 bytes as the
+// compiler counts them
+function editBetween(before, after) {
+  let start = 0;
+  const limit = Math.min(before.length, after.length);
+  while (start < limit && before[start] === after[start]) start++;
+  // Never split a surrogate pair between the kept and changed parts
+  const isHigh = (c) => c >= 0xd800 && c <= 0xdbff;
+  if (start > 0 && isHigh(before.charCodeAt(start - 1))) start--;
+  let end = 0;
+  while (end < limit - start && before[before.length - 1 - end] === after[after.length - 1 - end]) end++;
+  if (end > 0 && isHigh(before.charCodeAt(before.length - end - 1))) end--;
+  return {
+    offset: utf8.encode(before.slice(0, start)).length,
+    deleted: utf8.encode(before.slice(start, before.length - end)).length,
+    inserted: after.slice(start, after.length - end),
+  };
+}
+
 function App() {
   const [code, setCode] = useState(`val x=2;\nval y=x+8;\nprt(y);`);
   const [output, setOutput] = useState("");
   const [isError, setIsError] = useState(false);
   const [loading, setLoading] = useState(false);
   const [parseTree, setParseTree] = useState(null); // ✅ Parse Tree state
+  const [live, setLive] = useState(false);
   const outputRef = useRef(null);
+  // Live mode keeps an editor session on the server and sends only edits
+  const sessionId = useRef(Math.random().toString(36).slice(2));
+  const serverText = useRef(null); // the text the session holds, null if none
+  const inFlight = useRef(false);
+  const latestCode = useRef(code);
+
+  const showResult = (data) => {
+    setIsError(data.type === "error");
+    setOutput(data.output || "No output");
+
+    const tree = extractParseTreeFromOutput(data.output); // ✅ Get tree from output
+    setParseTree(tree);
+
+    if (outputRef.current) {
+      outputRef.current.scrollTop = outputRef.current.scrollHeight;
+    }
+  };
+
+  const post = async (body) => {
+    const response = await fetch(COMPILER_URL, {
+      method: "POST",
+      headers: { "Content-Type": "application/json" },
+      body: JSON.stringify(body),
+    });
+    return response.json();
+  };
+
+  // Sends the edits made since the last request, one request at a time;
+  // keystrokes typed meanwhile go out together in the next one
+  const syncLive = async () => {
+    if (inFlight.current) return;
+    inFlight.current = true;
+    try {
+      while (serverText.current !== latestCode.current) {
+        const text = latestCode.current;
+        const session = sessionId.current;
+        let data = serverText.current === null
+          ? await post({ code: text, session })
+          : await post({ session, edit: editBetween(serverText.current, text) });
+        if (data.type === "resync") data = await post({ code: text, session });
+        serverText.current = text;
+        showResult(data);
+      }
+    } catch (error) {
+      serverText.current = null;
+      setOutput("❌ Network Error: Could not reach compiler");
+      setIsError(true);
+    } finally {
+      inFlight.current = false;
+    }
+  };
+
+  useEffect(() => {
+    latestCode.current = code;
+    if (live) syncLive();
+    // eslint-disable-next-line react-hooks/exhaustive-deps
+  }, [code, live]);
 
   const handleRun = async () => {
     setLoading(true);
@@ -19,21 +99,7 @@ function App() {
     setParseTree(null); // ✅ Reset parse tree before each run
 
     try {
-      const response = await fetch("https://custom-compiler-wkpy.onrender.com", {
-        method: "POST",
-        headers: { "Content-Type": "application/json" },
-        body: JSON.stringify({ code }),
-      });
-      const data = await response.json();
-      setIsError(data.type === "error");
-      setOutput(data.output || "No output");
-
-      const tree = extractParseTreeFromOutput(data.output); // ✅ Get tree from output
-      setParseTree(tree);
-
-      if (outputRef.current) {
-        outputRef.current.scrollTop = outputRef.current.scrollHeight;
-      }
+      showResult(await post({ code }));
     } catch (error) {
       setOutput("❌ Network Error: Could not reach compiler");
       setIsError(true);
@@ -59,6 +125,14 @@ function App() {
             spellCheck="false"
             placeholder="Enter your Mukku code here..."
           />
+          <label className="live-toggle">
+            <input
+              type="checkbox"
+              checked={live}
+              onChange={(e) => setLive(e.target.checked)}
+            />
+            Compile as I type
+          </label>
           <button
             className={`run-btn ${loading ? "loading" : ""}`}
             onClick={handleRun}
@@ -12,15 +12,13 @@ export function extractParseTreeFromOutput(outputText) {
   const jsonMatch = jsonPart.match(/\{[\s\S]*\}/);
   if (!jsonMatch) return null;
 
-  let jsonText = jsonMatch[0];
-
-  // ✅ Fix invalid double-double quotes (e.g., ""hi"") ➝ "hi"
-  jsonText = jsonText.replace(/""([^"]*?)""/g, '"$1"');
+  // The compiler escapes string values, so the block is valid JSON as-is
+  const jsonText = jsonMatch[0];
 
   try {
     return JSON.parse(jsonText);
   } catch (err) {
-    console.error('❌ Failed to parse corrected tree JSON:', err);
+    console.error('❌ Failed to parse tree JSON:', err);
     return null;
   }
 }
@@ -5,8 +5,63 @@
 #include <map>
 #include <memory>
 #include <cctype>
-#include <regex>
 #include <set>
+#include <string_view>
+#include <cstring>
+#include <unordered_map>
+#include <algorithm>
+#include <charconv>
+#include <climits>
+#include <cstdio>
+#include <sstream>
+#include <array>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <unordered_set>
+#include <list>
+#include <filesystem>
+#include <random>
+#include <ctime>
+#include <sys/resource.h>
+
+// Source files are mapped into memory where POSIX allows
+#if defined(__unix__) || defined(__APPLE__)
+#define MUKKU_MMAP 1
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+// The scanner measures character runs with SSE2, or AVX2 where the CPU has it
+#if defined(__x86_64__) && defined(__GNUC__)
+#define MUKKU_SIMD 1
+#include <immintrin.h>
+#endif
+
+// HTTP mode runs an epoll loop
+#if defined(__linux__)
+#define MUKKU_HTTP 1
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <csignal>
+#endif
+
+// Native execution needs x86-64 and mmap'able executable memory
+#if defined(__x86_64__) && defined(__linux__)
+#define MUKKU_JIT 1
+#include <sys/mman.h>
+#endif
 
 using namespace std;
 
@@ -19,735 +74,7171 @@ enum class TokenType {
     END
 };
 
-// Token structure
+// Offsets are 32-bit, so longer sources are refused before lexing
+const size_t MAX_SOURCE_BYTES = UINT32_MAX;
+
+// Token structure: a span into the compiler's source buffer. Identifiers
+// also carry their interned symbol ID. Line and column are looked up from
+// the offset (see LineIndex) only when something prints them.
 struct Token {
     TokenType type;
-    string value;
-    int line;
+    uint32_t offset;
+    uint32_t length;
+    int symbol = -1;
+
+    Token(TokenType t, uint32_t off, uint32_t len, int sym = -1)
+        : type(t), offset(off), length(len), symbol(sym) {}
+};
+
+// An illegal character the scanner skipped
+struct LexError {
+    uint32_t offset;
+};
+
+// A compile error and the source range it points at
+struct Diagnostic {
+    const char* phase;            // "lexical", "syntax" or "semantic"
+    string message;
+    uint32_t offset;
+    uint32_t length;
+    int line;                     // 0 until the compiler locates 'offset'
     int column;
 
-    Token(TokenType t, string v, int l, int c) 
-        : type(t), value(v), line(l), column(c) {}
+    string format() const {
+        return "Line " + to_string(line) + ", Column " + to_string(column) + ": " + message;
+    }
 };
 
-// AST Node structure
-struct ASTNode {
-    string nodeType;
-    vector<shared_ptr<ASTNode>> children;
-    string value;
-    int indentLevel = 0;
+// --- Character scanning ---
+// Each scan returns the first byte at or after 'p' that is not in its
+// class, or 'end'. Runs are measured 16 (SSE2) or 32 (AVX2) bytes per
+// step by comparing every lane and finding the first miss in the mask;
+// the last few bytes before 'end' are checked one at a time.
 
-    ASTNode(string type, string val = "") : nodeType(type), value(val) {}
+struct SpaceChars {
+    static bool test(unsigned char c) { return c == ' ' || (c >= '\t' && c <= '\r'); }
+#ifdef MUKKU_SIMD
+    static __m128i lanes(__m128i v) {
+        __m128i control = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('\t' - 1)),
+                                        _mm_cmplt_epi8(v, _mm_set1_epi8('\r' + 1)));
+        return _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), control);
+    }
+    __attribute__((target("avx2"))) static __m256i lanes(__m256i v) {
+        __m256i control = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('\t' - 1)),
+                                           _mm256_cmpgt_epi8(_mm256_set1_epi8('\r' + 1), v));
+        return _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), control);
+    }
+#endif
+};
 
-    void addChild(shared_ptr<ASTNode> child) {
-        child->indentLevel = indentLevel + 1;
-        children.push_back(child);
+struct DigitChars {
+    static bool test(unsigned char c) { return (unsigned)(c - '0') < 10; }
+#ifdef MUKKU_SIMD
+    static __m128i lanes(__m128i v) {
+        return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+    }
+    __attribute__((target("avx2"))) static __m256i lanes(__m256i v) {
+        return _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('0' - 1)),
+                                _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), v));
     }
+#endif
+};
 
-    void print() const {
-        cout << string(indentLevel * 2, ' ') << "└─ " << nodeType;
-        if (!value.empty()) cout << " (" << value << ")";
-        cout << endl;
-        for (const auto& child : children) {
-            child->print();
-        }
+// Letters, digits and '_'. Setting bit 5 folds upper case onto lower.
+struct IdentChars {
+    static bool test(unsigned char c) { return DigitChars::test(c) || c == '_' || (unsigned char)((c | 0x20) - 'a') < 26; }
+#ifdef MUKKU_SIMD
+    static __m128i lanes(__m128i v) {
+        __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+        __m128i letter = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                                       _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+        return _mm_or_si128(_mm_or_si128(letter, DigitChars::lanes(v)), _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
     }
+    __attribute__((target("avx2"))) static __m256i lanes(__m256i v) {
+        __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+        __m256i letter = _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)),
+                                          _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), lower));
+        return _mm256_or_si256(_mm256_or_si256(letter, DigitChars::lanes(v)),
+                               _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')));
+    }
+#endif
+};
 
-    // JSON output for visualization
-    void printJSON(ostream& out, int indent = 0) const {
-        string ind(indent, ' ');
-        out << ind << "{\n";
-        out << ind << "  \"type\": \"" << nodeType << "\"";
-        if (!value.empty()) out << ",\n" << ind << "  \"value\": \"" << value << "\"";
-        if (!children.empty()) {
-            out << ",\n" << ind << "  \"children\": [\n";
-            for (size_t i = 0; i < children.size(); ++i) {
-                children[i]->printJSON(out, indent + 4);
-                if (i + 1 < children.size()) out << ",\n";
-            }
-            out << "\n" << ind << "  ]";
-        }
-        out << "\n" << ind << "}";
+template <class Chars>
+static const char* scanScalar(const char* p, const char* end) {
+    while (p < end && Chars::test(*p)) ++p;
+    return p;
+}
+
+#ifdef MUKKU_SIMD
+static const bool HAS_AVX2 = (__builtin_cpu_init(), __builtin_cpu_supports("avx2"));
+
+template <class Chars>
+static const char* scanSse2(const char* p, const char* end) {
+    for (; end - p >= 16; p += 16) {
+        unsigned misses = ~_mm_movemask_epi8(Chars::lanes(_mm_loadu_si128((const __m128i*)p))) & 0xFFFF;
+        if (misses) return p + __builtin_ctz(misses);
     }
+    return scanScalar<Chars>(p, end);
+}
 
-    string generateIntermediateCode(vector<string>& code, int& tempCount) {
-        if (nodeType == "Program") {
-            for (const auto& child : children) {
-                child->generateIntermediateCode(code, tempCount);
-            }
-        }
-        else if (nodeType == "Declaration") {
-            if (!children.empty()) {
-                string temp = children[0]->generateIntermediateCode(code, tempCount);
-                code.push_back(value + " = " + temp);
-            }
-        }
-        else if (nodeType == "BinaryExpr") {
-            string leftTemp = children[0]->generateIntermediateCode(code, tempCount);
-            string rightTemp = children[1]->generateIntermediateCode(code, tempCount);
-            string resultTemp = "T" + to_string(++tempCount);
-            code.push_back(resultTemp + " = " + leftTemp + " " + value + " " + rightTemp);
-            return resultTemp;
-        }
-        else if (nodeType == "Identifier") {
-            return value;
-        }
-        else if (nodeType == "NumberLiteral") {
-            return value;
-        }
-        else if (nodeType == "Return") {
-            if (!children.empty()) {
-                string retVal = children[0]->generateIntermediateCode(code, tempCount);
-                code.push_back("return " + retVal);
-            }
-        }
-        else if (nodeType == "Print") {
-            if (!children.empty()) {
-                string val = children[0]->generateIntermediateCode(code, tempCount);
-                code.push_back("print " + val);
-            }
-        }
-        else if (nodeType == "IfElse") {
-            string cond = children[0]->generateIntermediateCode(code, tempCount);
-            string labelElse = "L" + to_string(++tempCount);
-            string labelEnd = "L" + to_string(++tempCount);
-        
-            code.push_back("ifnot " + cond + " goto " + labelElse);
-            children[1]->generateIntermediateCode(code, tempCount);
-            code.push_back("goto " + labelEnd);
-            code.push_back(labelElse + ":");
-            if (children.size() > 2) {
-                children[2]->generateIntermediateCode(code, tempCount);
-            }
-            code.push_back(labelEnd + ":");
-        }
-        
-        return "";
+template <class Chars>
+__attribute__((target("avx2"))) static const char* scanAvx2(const char* p, const char* end) {
+    for (; end - p >= 32; p += 32) {
+        unsigned misses = ~(unsigned)_mm256_movemask_epi8(Chars::lanes(_mm256_loadu_si256((const __m256i*)p)));
+        if (misses) return p + __builtin_ctz(misses);
     }
+    return scanSse2<Chars>(p, end);
+}
+#endif
 
-    // Assembly code generation using registers
-    string getRegister(int idx) const {
-        static vector<string> regs = {"eax", "ebx", "ecx", "edx"};
-        return regs[idx % regs.size()];
-    }
-
-    string generateAssembly(vector<string>& asmCode, int& regCount) const {
-        if (nodeType == "NumberLiteral" || nodeType == "Identifier") {
-            string reg = getRegister(regCount++);
-            asmCode.push_back("mov " + reg + ", " + value);
-            return reg;
-        }
-        if (nodeType == "BinaryExpr") {
-            int leftRegIdx = regCount;
-            string leftReg = children[0]->generateAssembly(asmCode, regCount);
-            int rightRegIdx = regCount;
-            string rightReg = children[1]->generateAssembly(asmCode, regCount);
-
-            if (value == "+") {
-                asmCode.push_back("add " + leftReg + ", " + rightReg);
-                return leftReg;
-            } else if (value == "-") {
-                asmCode.push_back("sub " + leftReg + ", " + rightReg);
-                return leftReg;
-            } else if (value == "*") {
-                asmCode.push_back("imul " + leftReg + ", " + rightReg);
-                return leftReg;
-            } else if (value == "/") {
-                asmCode.push_back("cdq");
-                asmCode.push_back("idiv " + rightReg);
-                return leftReg;
-            }
-        }
-        if (nodeType == "Declaration") {
-            if (!children.empty()) {
-                int regCountLocal = 0;
-                string resultReg = children[0]->generateAssembly(asmCode, regCountLocal);
-                asmCode.push_back("mov " + value + ", " + resultReg);
-            } else {
-                asmCode.push_back("mov " + value + ", 0");
-            }
-            return "";
+template <class Chars>
+static inline const char* scanRun(const char* p, const char* end) {
+    // Most runs end within two bytes; those never reach the vector loop
+    for (int i = 0; i < 2; ++i, ++p) {
+        if (p == end || !Chars::test(*p)) return p;
+    }
+#ifdef MUKKU_SIMD
+    return HAS_AVX2 ? scanAvx2<Chars>(p, end) : scanSse2<Chars>(p, end);
+#else
+    return scanScalar<Chars>(p, end);
+#endif
+}
+
+// Where each line of a source starts, so token offsets can be turned into
+// line and column when a listing or a diagnostic needs them. Newlines are
+// found a vector at a time, each set bit of the compare mask being one.
+class LineIndex {
+    vector<uint32_t> starts;      // offset of each line's first byte
+
+    void addNewlines(uint32_t base, unsigned mask) {
+        for (; mask; mask &= mask - 1) starts.push_back(base + __builtin_ctz(mask) + 1);
+    }
+
+#ifdef MUKKU_SIMD
+    __attribute__((target("avx2"))) size_t buildAvx2(const char* data, size_t size) {
+        size_t i = 0;
+        for (__m256i newline = _mm256_set1_epi8('\n'); i + 32 <= size; i += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(data + i));
+            addNewlines(i, _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, newline)));
         }
-        if (nodeType == "Program") {
-            for (const auto& child : children) {
-                child->generateAssembly(asmCode, regCount);
-            }
-            return "";
+        return i;
+    }
+
+    size_t buildSse2(const char* data, size_t size) {
+        size_t i = 0;
+        for (__m128i newline = _mm_set1_epi8('\n'); i + 16 <= size; i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+            addNewlines(i, _mm_movemask_epi8(_mm_cmpeq_epi8(v, newline)));
         }
-        if (nodeType == "Return") {
-            if (!children.empty()) {
-                int regCountLocal = 0;
-                string retReg = children[0]->generateAssembly(asmCode, regCountLocal);
-                asmCode.push_back("mov eax, " + retReg); // Conventionally, return value in eax
-                asmCode.push_back("ret");
-            }
-            return "";
-        }        
-        return "";
+        return i;
     }
-};
+#endif
 
-// Interpreter for executing the AST and showing output
-class Interpreter {
-    map<string, int> variables;
 public:
-    void execute(shared_ptr<ASTNode> node) {
-        if (!node) return;
-        if (node->nodeType == "Program") {
-            for (auto& child : node->children)
-                execute(child);
-        } else if (node->nodeType == "Declaration") {
-            string var = node->value;
-            int val = evaluate(node->children[0]);
-            variables[var] = val;
-        } else if (node->nodeType == "Print") {
-            if (!node->children.empty()) {
-                if (node->children[0]->nodeType == "StringLiteral") {
-                    // Remove quotes from string literal
-                    string s = node->children[0]->value;
-                    if (s.size() >= 2 && s.front() == '"' && s.back() == '"')
-                        s = s.substr(1, s.size()-2);
-                    cout << s << endl;
-                } else {
-                    int val = evaluate(node->children[0]);
-                    cout << val << endl;
-                }
-            }
-        } else if (node->nodeType == "IfElse") {
-            int cond = evaluate(node->children[0]);
-            if (cond) {
-                execute(node->children[1]);
-            } else if (node->children.size() > 2) {
-                execute(node->children[2]);
-            }
-        } else if (node->nodeType == "Block") {
-            for (auto& child : node->children)
-                execute(child);
-        } else if (node->nodeType == "Return") {
-            // For now, just print the return value
-            int val = evaluate(node->children[0]);
-            cout << "Return: " << val << endl;
-        }
-    }
-
-    int evaluate(shared_ptr<ASTNode> node) {
-        if (node->nodeType == "NumberLiteral") {
-            return stoi(node->value);
-        } else if (node->nodeType == "Identifier") {
-            return variables[node->value];
-        } else if (node->nodeType == "BinaryExpr") {
-            int left = evaluate(node->children[0]);
-            int right = evaluate(node->children[1]);
-            if (node->value == "+") return left + right;
-            if (node->value == "-") return left - right;
-            if (node->value == "*") return left * right;
-            if (node->value == "/") return left / right;
-            if (node->value == "==") return left == right;
-            if (node->value == "!=") return left != right;
-            if (node->value == "<") return left < right;
-            if (node->value == "<=") return left <= right;
-            if (node->value == ">") return left > right;
-            if (node->value == ">=") return left >= right;
+    bool empty() const { return starts.empty(); }
+    void clear() { starts.clear(); }
+
+    void build(string_view text) {
+        starts.assign(1, 0);
+        size_t i = 0;
+#ifdef MUKKU_SIMD
+        i = HAS_AVX2 ? buildAvx2(text.data(), text.size()) : buildSse2(text.data(), text.size());
+#endif
+        for (; i < text.size(); ++i) {
+            if (text[i] == '\n') starts.push_back(i + 1);
         }
-        return 0;
+    }
+
+    // Line (from 1) and column (from 0) of 'offset'
+    pair<int, int> locate(uint32_t offset) const {
+        size_t line = upper_bound(starts.begin(), starts.end(), offset) - starts.begin();
+        return {(int)line, (int)(offset - starts[line - 1])};
     }
 };
 
+// Identifier interner: gives every distinct name a dense integer ID.
+// Names are views into the source buffer, so interning never copies,
+// unless the interner owns its names because it outlives the buffer.
+class SymbolInterner {
+    vector<string_view> names;
+    unordered_map<string_view, int> ids;
+    deque<string> storage;           // owned names; deque keeps them in place
+    bool owning = false;
+public:
+    void setOwning(bool own) { owning = own; }
 
-// Compiler class
-class MukkuCompiler {
-private:
-    vector<Token> tokens;
-    size_t currentTokenIndex = 0;
-    map<string, string> symbolTable;
-    vector<string> errors;
-    vector<string> intermediateCode;
-    shared_ptr<ASTNode> ast;
-    // --- Reserved keywords set for identifier check ---
-    const std::set<std::string> reservedKeywords = {"val", "prt", "agar", "nhi-to", "bhejo"};
+    int intern(string_view name) {
+        auto it = ids.find(name);
+        if (it != ids.end()) return it->second;
+        int id = names.size();
+        if (owning) name = storage.emplace_back(name);
+        names.push_back(name);
+        ids.emplace(name, id);
+        return id;
+    }
+
+    string_view name(int id) const { return names[id]; }
+    size_t size() const { return names.size(); }
+
+    void clear() {
+        names.clear();
+        ids.clear();
+        storage.clear();
+    }
+};
 
+// Declared variables, by scope. Every declaration gets a symbol of its
+// own, and a symbol's index is the slot the back ends store it in. Name
+// IDs are dense, so the innermost visible symbol of each name sits in a
+// flat array; leaving a scope restores the names it shadowed.
+class SymbolTable {
 public:
-    void compile(const string& filename) {
-        ifstream file(filename);
-        if (!file.is_open()) {
-            cerr << "Error: Could not open file '" << filename << "'" << endl;
-            return;
+    enum class Kind : uint8_t { Variable };
+
+    struct Symbol {
+        int id;                   // interned name
+        uint32_t offset;          // declaration site: the name's offset in the source
+        uint32_t depth;           // scopes enclosing the declaration; 0 is the program
+        uint32_t version;         // earlier declarations of the same name
+        Kind kind;
+    };
+
+    static const char* kindName(Kind kind) {
+        switch (kind) {
+            case Kind::Variable: return "variable";
         }
+        return "";
+    }
 
-        string sourceCode((istreambuf_iterator<char>(file)), 
-                         istreambuf_iterator<char>());
-        file.close();
+    // Starts an empty table over the names interned so far
+    void reset(const SymbolInterner& names) {
+        interner = &names;
+        symbols.clear();
+        symbols.reserve(names.size());
+        visible.assign(names.size(), -1);
+        declarations.assign(names.size(), 0);
+        shadowed.clear();
+        scopes.clear();
+    }
 
-        cout << "=== Source Code ===" << endl;
-        cout << sourceCode << endl << endl;
+    void enterScope() { scopes.push_back(shadowed.size()); }
 
-        // Phase 1: Lexical Analysis
-        cout << "=== Lexical Analysis (Tokenization) ===" << endl;
-        tokenize(sourceCode);
-        printTokens();
+    void exitScope() {
+        for (size_t i = shadowed.size(); i-- > scopes.back();) visible[shadowed[i].first] = shadowed[i].second;
+        shadowed.resize(scopes.back());
+        scopes.pop_back();
+    }
 
-        if (!errors.empty()) {
-            printErrors();
-            return;
-        }
+    // Whether the innermost scope declares name ID 'id'
+    bool declaredInScope(int id) const {
+        return visible[id] >= 0 && symbols[visible[id]].depth == scopes.size();
+    }
 
-        // Phase 2: Syntax Analysis
-        cout << "\n=== Syntax Analysis (Parsing) ===" << endl;
-        ast = parseProgram();
+    // Declares name ID 'id' in the innermost scope and returns its slot,
+    // or -1 if that scope already declares it
+    int declare(int id, Kind kind, uint32_t offset) {
+        if (declaredInScope(id)) return -1;
+        // The program scope is never left, so it needs nothing to undo
+        if (!scopes.empty()) shadowed.push_back({id, visible[id]});
+        visible[id] = symbols.size();
+        symbols.push_back({id, offset, (uint32_t)scopes.size(), declarations[id]++, kind});
+        return visible[id];
+    }
 
-        if (!errors.empty()) {
-            printErrors();
-            return;
-        } 
+    // Slot of the innermost visible declaration of name ID 'id', or -1
+    int lookup(int id) const { return visible[id]; }
+
+    const Symbol& operator[](int slot) const { return symbols[slot]; }
+    string_view name(int slot) const { return interner->name(symbols[slot].id); }
+    size_t size() const { return symbols.size(); }
+
+    // The name as listings show it: later declarations of a name that was
+    // declared before get a ".n" suffix so they read as distinct variables
+    string label(int slot) const {
+        const Symbol& symbol = symbols[slot];
+        if (symbol.version == 0) return string(name(slot));
+        return string(name(slot)) + "." + to_string(symbol.version);
+    }
+
+    void clear() {
+        symbols.clear();
+        visible.clear();
+        declarations.clear();
+        shadowed.clear();
+        scopes.clear();
+    }
+
+private:
+    const SymbolInterner* interner = nullptr;
+    vector<Symbol> symbols;
+    vector<int> visible;                  // name ID -> innermost visible slot, -1 if none
+    vector<uint32_t> declarations;        // name ID -> symbols declared with it so far
+    vector<pair<int, int>> shadowed;      // (name ID, slot it hid), undone when the scope ends
+    vector<size_t> scopes;                // shadowed.size() where each open scope began
+};
 
-        // === JSON Parse Tree Output ===
-        cout << "\nParse Tree (JSON):" << endl;
-        if (ast) ast->printJSON(cout, 0);
-        cout << endl;
+const char* tokenTypeName(TokenType type) {
+    switch (type) {
+        case TokenType::VAL:
+        case TokenType::PRT:
+        case TokenType::AGAR:
+        case TokenType::NHI_TO:
+        case TokenType::BHEJO:
+            return "Keyword";
+        case TokenType::ID: return "ID";
+        case TokenType::NUMBER: return "NUMBER";
+        case TokenType::STRING: return "STRING";
+        case TokenType::OP: return "OP";
+        case TokenType::COMPARE: return "COMPARE";
+        case TokenType::ASSIGN: return "ASSIGN";
+        case TokenType::LPAREN: return "LPAREN";
+        case TokenType::RPAREN: return "RPAREN";
+        case TokenType::LBRACE: return "LBRACE";
+        case TokenType::RBRACE: return "RBRACE";
+        case TokenType::SEMI: return "SEMI";
+        case TokenType::END: return "END";
+    }
+    return "";
+}
 
-        // Phase 3: Semantic Analysis
-        cout << "\n=== Semantic Analysis ===" << endl;
-        semanticAnalysis(ast.get());
+// Streaming JSON writer. Separators and nesting are tracked here and every
+// string is escaped, so the output is always one well-formed document.
+class JsonWriter {
+    ostream& out;
+    vector<bool> empty;    // per open container: nothing written yet
+    bool afterKey = false;
 
-        if (!errors.empty()) {
-            printErrors();
+    void separator() {
+        if (afterKey) {
+            afterKey = false;
             return;
         }
-
-        cout << "\nSymbol Table:" << endl;
-        for (const auto& entry : symbolTable) {
-            cout << entry.first << ": " << entry.second << endl;
+        if (!empty.empty()) {
+            if (!empty.back()) out << ',';
+            empty.back() = false;
         }
+    }
 
-        // Phase 4: Intermediate Code Generation
-        cout << "\n=== Intermediate Code Generation ===" << endl;
-        int tempCount = 0;
-        ast->generateIntermediateCode(intermediateCode, tempCount);
+public:
+    explicit JsonWriter(ostream& o) : out(o) {}
 
-        cout << "\nIntermediate Code (Three-Address Code):" << endl;
-        for (size_t i = 0; i < intermediateCode.size(); ++i) {
-            cout << i << ": " << intermediateCode[i] << endl;
+    // Length of the well-formed UTF-8 sequence at s[i], or 0 if invalid
+    static size_t utf8Length(string_view s, size_t i) {
+        unsigned char c = s[i];
+        size_t n = c >= 0xF0 && c <= 0xF4 ? 4 : c >= 0xE0 ? 3 : c >= 0xC2 && c < 0xE0 ? 2 : 0;
+        if (n == 0 || c > 0xF4 || i + n > s.size()) return 0;
+        for (size_t k = 1; k < n; ++k) {
+            if (((unsigned char)s[i + k] & 0xC0) != 0x80) return 0;
         }
+        unsigned char c1 = s[i + 1];
+        if ((c == 0xE0 && c1 < 0xA0) || (c == 0xED && c1 >= 0xA0) ||
+            (c == 0xF0 && c1 < 0x90) || (c == 0xF4 && c1 >= 0x90)) return 0;
+        return n;
+    }
 
-        // Phase 5: Assembly Code Generation
-        cout << "\n=== Assembly Code Generation ===" << endl;
-        vector<string> asmCode;
-        int regCount = 0;
-        if (ast) ast->generateAssembly(asmCode, regCount);
-
-        cout << "\nAssembly Code:" << endl;
-        for (size_t i = 0; i < asmCode.size(); ++i) {
-            cout << i << ": " << asmCode[i] << endl;
+    // Escapes quotes, backslashes and control characters; bytes that are
+    // not valid UTF-8 (e.g. from an illegal-character error) become U+FFFD.
+    static void writeEscaped(ostream& out, string_view s) {
+        static const char hex[] = "0123456789abcdef";
+        size_t run = 0;
+        for (size_t i = 0; i < s.size(); ++i) {
+            unsigned char c = s[i];
+            if (c >= 0x80) {
+                size_t n = utf8Length(s, i);
+                if (n) {
+                    i += n - 1;
+                    continue;
+                }
+            } else if (c >= 0x20 && c != '"' && c != '\\') {
+                continue;
+            }
+            out.write(s.data() + run, i - run);
+            run = i + 1;
+            switch (c) {
+                case '"': out << "\\\""; break;
+                case '\\': out << "\\\\"; break;
+                case '\n': out << "\\n"; break;
+                case '\r': out << "\\r"; break;
+                case '\t': out << "\\t"; break;
+                default:
+                    if (c >= 0x80) out << "\\ufffd";
+                    else out << "\\u00" << hex[c >> 4] << hex[c & 15];
+                    break;
+            }
         }
+        out.write(s.data() + run, s.size() - run);
+    }
 
-        cout << "\nCompilation successful!" << endl;
-        cout << "\n=== Output of Input Code ===" << endl;
-        Interpreter interpreter;
-        interpreter.execute(ast);
+    JsonWriter& beginObject() { separator(); out << '{'; empty.push_back(true); return *this; }
+    JsonWriter& endObject() { empty.pop_back(); out << '}'; return *this; }
+    JsonWriter& beginArray() { separator(); out << '['; empty.push_back(true); return *this; }
+    JsonWriter& endArray() { empty.pop_back(); out << ']'; return *this; }
 
+    JsonWriter& key(string_view k) {
+        separator();
+        out << '"';
+        writeEscaped(out, k);
+        out << "\":";
+        afterKey = true;
+        return *this;
     }
 
-private:
-    void tokenize(const string& source) {
-        vector<pair<string, TokenType>> tokenSpecs = {
-            {"val", TokenType::VAL},
-            {"prt", TokenType::PRT},
-            {"agar", TokenType::AGAR},
-            {"nhi-to", TokenType::NHI_TO},
-            {"bhejo", TokenType::BHEJO},
-            {"==", TokenType::COMPARE},
-    {"!=", TokenType::COMPARE},
-    {"<=", TokenType::COMPARE},
-    {">=", TokenType::COMPARE},
+    JsonWriter& value(string_view s) {
+        separator();
+        out << '"';
+        writeEscaped(out, s);
+        out << '"';
+        return *this;
+    }
+    JsonWriter& value(const char* s) { return value(string_view(s)); }
+    JsonWriter& value(long long n) { separator(); out << n; return *this; }
+    JsonWriter& value(int n) { return value((long long)n); }
+    JsonWriter& value(bool b) { separator(); out << (b ? "true" : "false"); return *this; }
+    JsonWriter& value(double d) { separator(); out << d; return *this; }
+    // Writes 'json', which must already be a JSON value, as it is
+    JsonWriter& raw(string_view json) { separator(); out << json; return *this; }
+};
 
-    // Single-character comparison operators
-    {"<", TokenType::COMPARE},
-    {">", TokenType::COMPARE},
+// A parsed JSON document. Numbers are doubles and object members keep
+// their order.
+struct JsonValue {
+    enum class Type : uint8_t { Null, Bool, Number, String, Array, Object };
+    Type type = Type::Null;
+    bool boolean = false;
+    double number = 0;
+    string text;
+    vector<JsonValue> items;
+    vector<pair<string, JsonValue>> members;
 
-    // Assignment operator
-    {"=", TokenType::ASSIGN},
+    bool isString() const { return type == Type::String; }
+    bool isNull() const { return type == Type::Null; }
 
-    {"[+*/\\-]", TokenType::OP},
+    // The member named 'name', or null if there is none. Like most
+    // readers, the last of duplicate names wins.
+    const JsonValue* find(string_view name) const {
+        for (auto it = members.rbegin(); it != members.rend(); ++it) {
+            if (it->first == name) return &it->second;
+        }
+        return nullptr;
+    }
+};
 
-    // Parentheses and braces
-    {"\\(", TokenType::LPAREN},
-    {"\\)", TokenType::RPAREN},
-    {"\\{", TokenType::LBRACE},
-    {"\\}", TokenType::RBRACE},
-    {";", TokenType::SEMI},
+// Recursive-descent reader for one JSON document. Escapes are decoded to
+// UTF-8 and a lone surrogate becomes U+FFFD; nesting is capped so deep
+// input can't exhaust the stack.
+class JsonReader {
+    string_view text;
+    size_t pos = 0;
+    int depth = 0;
+    static constexpr int MAX_DEPTH = 64;
 
-    // Literals
-    {"\"[^\"]*\"", TokenType::STRING}, // String literals
-    {"[0-9]+", TokenType::NUMBER},     // Numbers
+    explicit JsonReader(string_view t) : text(t) {}
 
-    // Identifiers
-    {"[a-zA-Z_][a-zA-Z0-9_]*", TokenType::ID},
-        };
-        
-        
+    void skipSpace() {
+        while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\n' || text[pos] == '\r')) {
+            ++pos;
+        }
+    }
 
-        size_t pos = 0;
-        int line = 1;
-        int lineStart = 0;
-
-        while (pos < source.length()) {
-            while (pos < source.length() && isspace(source[pos])) {
-                if (source[pos] == '\n') {
-                    line++;
-                    lineStart = pos + 1;
-                }
-                pos++;
-            }
-            if (pos >= source.length()) break;
-
-            bool matched = false;
-            for (size_t i = 0; i < tokenSpecs.size(); ++i) {
-                const string& pattern = tokenSpecs[i].first;
-                TokenType type = tokenSpecs[i].second;
-
-                regex re("^" + pattern);
-                smatch match;
-                string remaining = source.substr(pos);
-                
-                if (regex_search(remaining, match, re)) {
-                    string value = match.str();
-                    int column = pos - lineStart;
-
-                    tokens.emplace_back(type, value, line, column);
-                    pos += value.length();
-                    matched = true;
-                    break;
-                }
-            }
+    bool consume(char c) {
+        skipSpace();
+        if (pos >= text.size() || text[pos] != c) return false;
+        ++pos;
+        return true;
+    }
 
-            if (!matched) {
-                int column = pos - lineStart;
-                errors.push_back("Illegal character '" + string(1, source[pos]) + 
-                               "' at line " + to_string(line) + 
-                               ", column " + to_string(column));
-                pos++;
-            }
-        }
-        tokens.emplace_back(TokenType::END, "", line, 0);
+    bool literal(string_view word) {
+        if (text.substr(pos, word.size()) != word) return false;
+        pos += word.size();
+        return true;
     }
 
-    // --- Parser for declarations and expressions ---
-    shared_ptr<ASTNode> parseStatement() {
-        if (currentToken().type == TokenType::VAL) {
-            return parseDeclaration();
-        } else if (currentToken().type == TokenType::PRT) {
-            return parsePrint();
-        } else if (currentToken().type == TokenType::AGAR) {
-            return parseIfElse();
-        } else if (currentToken().type == TokenType::BHEJO) {
-            return parseReturn();
+    static void appendUtf8(string& out, uint32_t code) {
+        if (code < 0x80) {
+            out += (char)code;
+        } else if (code < 0x800) {
+            out += (char)(0xC0 | code >> 6);
+            out += (char)(0x80 | (code & 0x3F));
+        } else if (code < 0x10000) {
+            out += (char)(0xE0 | code >> 12);
+            out += (char)(0x80 | (code >> 6 & 0x3F));
+            out += (char)(0x80 | (code & 0x3F));
         } else {
-            errors.push_back("Unexpected statement or keyword '" + currentToken().value + "' at line " +
-                             to_string(currentToken().line) + ", column " + to_string(currentToken().column));
-            advance();
-            return nullptr;
+            out += (char)(0xF0 | code >> 18);
+            out += (char)(0x80 | (code >> 12 & 0x3F));
+            out += (char)(0x80 | (code >> 6 & 0x3F));
+            out += (char)(0x80 | (code & 0x3F));
         }
     }
-    
-    shared_ptr<ASTNode> parseProgram() {
-        auto program = make_shared<ASTNode>("Program");
-        while (currentToken().type != TokenType::END) {
-            auto stmt = parseStatement();
-            if (stmt) program->addChild(stmt);
+
+    bool hex4(uint32_t& code) {
+        if (pos + 4 > text.size()) return false;
+        code = 0;
+        for (int i = 0; i < 4; ++i) {
+            char c = text[pos++];
+            int digit = c >= '0' && c <= '9' ? c - '0'
+                      : c >= 'a' && c <= 'f' ? c - 'a' + 10
+                      : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+            if (digit < 0) return false;
+            code = code << 4 | digit;
         }
-        return program;
+        return true;
     }
-    
 
-    shared_ptr<ASTNode> parseReturn() {
-        advance(); // skip 'bhejo'
-        auto expr = parseExpression();
-        if (!expr) {
-            errors.push_back("Invalid expression in bhejo statement");
-            return nullptr;
-        }
-        if (currentToken().type != TokenType::SEMI) {
-            errors.push_back("Expected ';' after bhejo statement");
-            return nullptr;
+    bool parseString(string& out) {
+        if (!consume('"')) return false;
+        while (pos < text.size()) {
+            size_t run = pos;
+            while (pos < text.size() && text[pos] != '"' && text[pos] != '\\' && (unsigned char)text[pos] >= 0x20) {
+                ++pos;
+            }
+            out.append(text.data() + run, pos - run);
+            if (pos >= text.size() || (unsigned char)text[pos] < 0x20) return false;
+            if (text[pos++] == '"') return true;
+            if (pos >= text.size()) return false;
+            char escape = text[pos++];
+            switch (escape) {
+                case '"': case '\\': case '/': out += escape; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'n': out += '\n'; break;
+                case 'r': out += '\r'; break;
+                case 't': out += '\t'; break;
+                case 'u': {
+                    uint32_t code;
+                    if (!hex4(code)) return false;
+                    if (code >= 0xD800 && code < 0xDC00 && text.substr(pos, 2) == "\\u") {
+                        size_t mark = pos;
+                        uint32_t low;
+                        pos += 2;
+                        if (hex4(low) && low >= 0xDC00 && low < 0xE000) {
+                            code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                        } else {
+                            pos = mark;
+                        }
+                    }
+                    appendUtf8(out, code >= 0xD800 && code < 0xE000 ? 0xFFFD : code);
+                    break;
+                }
+                default: return false;
+            }
         }
-        advance(); // skip ';'
-        auto retNode = make_shared<ASTNode>("Return");
-        retNode->addChild(expr);
-        return retNode;
+        return false;
     }
-    
-    shared_ptr<ASTNode> parsePrint() {
-        advance(); // skip 'prt'
-        if (currentToken().type != TokenType::LPAREN) {
-            errors.push_back("Expected '(' after 'prt'");
-            return nullptr;
-        }
-        advance(); // skip '('
-    
-        shared_ptr<ASTNode> expr = nullptr;
-        if (currentToken().type == TokenType::STRING) {
-            expr = make_shared<ASTNode>("StringLiteral", currentToken().value);
-            advance();
-        } else {
-            expr = parseExpression();
-        }
-    
-        if (currentToken().type != TokenType::RPAREN) {
-            errors.push_back("Expected ')' after prt argument");
-            return nullptr;
+
+    bool parseNumber(double& number) {
+        size_t start = pos;
+        auto digits = [&] {
+            size_t first = pos;
+            while (pos < text.size() && text[pos] >= '0' && text[pos] <= '9') ++pos;
+            return pos > first;
+        };
+        if (pos < text.size() && text[pos] == '-') ++pos;
+        if (!digits()) return false;
+        if (pos < text.size() && text[pos] == '.') {
+            ++pos;
+            if (!digits()) return false;
         }
-        advance(); // skip ')'
-    
-        if (currentToken().type != TokenType::SEMI) {
-            errors.push_back("Expected ';' after prt statement");
-            return nullptr;
+        if (pos < text.size() && (text[pos] == 'e' || text[pos] == 'E')) {
+            ++pos;
+            if (pos < text.size() && (text[pos] == '+' || text[pos] == '-')) ++pos;
+            if (!digits()) return false;
         }
-        advance(); // skip ';'
-    
-        auto prtNode = make_shared<ASTNode>("Print");
-        if (expr) prtNode->addChild(expr);
-        return prtNode;
+        number = strtod(string(text.substr(start, pos - start)).c_str(), nullptr);
+        return true;
     }
-    
-    shared_ptr<ASTNode> parseIfElse() {
-        advance(); // skip 'agar'
-        if (currentToken().type != TokenType::LPAREN) {
-            errors.push_back("Expected '(' after 'agar'");
-            return nullptr;
-        }
-        advance(); // skip '('
-    
-        auto condition = parseExpression();
-        if (!condition) {
-            errors.push_back("Invalid condition in agar statement");
-            return nullptr;
-        }
-    
-        if (currentToken().type != TokenType::RPAREN) {
-            errors.push_back("Expected ')' after agar condition");
-            return nullptr;
-        }
-        advance(); // skip ')'
-    
-        if (currentToken().type != TokenType::LBRACE) {
-            errors.push_back("Expected '{' after agar condition");
-            return nullptr;
-        }
-        advance(); // skip '{'
-    
-        auto ifBlock = make_shared<ASTNode>("Block");
-        while (currentToken().type != TokenType::RBRACE && currentToken().type != TokenType::END) {
-            auto stmt = parseStatement();
-            if (stmt) ifBlock->addChild(stmt);
+
+    bool parseValue(JsonValue& value) {
+        skipSpace();
+        if (pos >= text.size()) return false;
+        char c = text[pos];
+        if (c == '"') {
+            value.type = JsonValue::Type::String;
+            return parseString(value.text);
         }
-        if (currentToken().type != TokenType::RBRACE) {
-            errors.push_back("Expected '}' at end of agar block");
-            return nullptr;
+        if (c == '{' || c == '[') {
+            if (++depth > MAX_DEPTH) return false;
+            ++pos;
+            bool object = c == '{';
+            value.type = object ? JsonValue::Type::Object : JsonValue::Type::Array;
+            if (!consume(object ? '}' : ']')) {
+                do {
+                    if (object) {
+                        value.members.emplace_back();
+                        if (!parseString(value.members.back().first) || !consume(':')) return false;
+                        if (!parseValue(value.members.back().second)) return false;
+                    } else {
+                        value.items.emplace_back();
+                        if (!parseValue(value.items.back())) return false;
+                    }
+                } while (consume(','));
+                if (!consume(object ? '}' : ']')) return false;
+            }
+            --depth;
+            return true;
         }
-        advance(); // skip '}'
-    
-        // Optional nhi-to
-        shared_ptr<ASTNode> elseBlock = nullptr;
-        if (currentToken().type == TokenType::NHI_TO) {
-            advance(); // skip 'nhi-to'
-            if (currentToken().type != TokenType::LBRACE) {
-                errors.push_back("Expected '{' after nhi-to");
-                return nullptr;
-            }
-            advance(); // skip '{'
-            elseBlock = make_shared<ASTNode>("Block");
-            while (currentToken().type != TokenType::RBRACE && currentToken().type != TokenType::END) {
-                auto stmt = parseStatement();
-                if (stmt) elseBlock->addChild(stmt);
-            }
-            if (currentToken().type != TokenType::RBRACE) {
-                errors.push_back("Expected '}' at end of nhi-to block");
-                return nullptr;
-            }
-            advance(); // skip '}'
+        if (literal("true") || literal("false")) {
+            value.type = JsonValue::Type::Bool;
+            value.boolean = c == 't';
+            return true;
         }
-    
-        auto ifElseNode = make_shared<ASTNode>("IfElse");
-        ifElseNode->addChild(condition);
-        ifElseNode->addChild(ifBlock);
-        if (elseBlock) ifElseNode->addChild(elseBlock);
-    
-        return ifElseNode;
+        if (literal("null")) return true;
+        value.type = JsonValue::Type::Number;
+        return parseNumber(value.number);
     }
-    
 
-    shared_ptr<ASTNode> parseDeclaration() {
-        advance(); // skip 'val'
-        // Check if the next token is a keyword
-    if (currentToken().type == TokenType::VAL ||
-    currentToken().type == TokenType::PRT ||
-    currentToken().type == TokenType::AGAR ||
-    currentToken().type == TokenType::NHI_TO ||
-    currentToken().type == TokenType::BHEJO) {
-    errors.push_back("Cannot use reserved keyword '" + currentToken().value + "' as an identifier after 'val' at line " + to_string(currentToken().line));
-    return nullptr;
+public:
+    // Parses 'text' as one complete document; false if it isn't valid JSON
+    static bool parse(string_view text, JsonValue& value) {
+        JsonReader reader(text);
+        value = JsonValue();
+        if (!reader.parseValue(value)) return false;
+        reader.skipSpace();
+        return reader.pos == text.size();
+    }
+};
+
+// AST node kinds
+enum class NodeKind : uint8_t {
+    Program, Declaration, BinaryExpr, Identifier, NumberLiteral,
+    StringLiteral, Print, IfElse, Block, Return
+};
+
+// Binary operators, resolved once by the parser
+enum class BinOp : uint8_t { ADD, SUB, MUL, DIV, EQ, NE, LT, LE, GT, GE };
+
+const char* binOpSymbol(BinOp op) {
+    switch (op) {
+        case BinOp::ADD: return "+";
+        case BinOp::SUB: return "-";
+        case BinOp::MUL: return "*";
+        case BinOp::DIV: return "/";
+        case BinOp::EQ: return "==";
+        case BinOp::NE: return "!=";
+        case BinOp::LT: return "<";
+        case BinOp::LE: return "<=";
+        case BinOp::GT: return ">";
+        case BinOp::GE: return ">=";
+    }
+    return "";
 }
-        if (currentToken().type != TokenType::ID) {
-            errors.push_back("Expected identifier after 'val' at line " + to_string(currentToken().line));
-            return nullptr;
-        }
-        string varName = currentToken().value;
-        if (reservedKeywords.count(varName)) {
-            errors.push_back("Cannot use reserved keyword '" + varName + "' as an identifier after 'val' at line " + to_string(currentToken().line));
-            return nullptr;
-        }
-        advance(); // skip ID
 
-        shared_ptr<ASTNode> expr = nullptr;
-        if (currentToken().type == TokenType::ASSIGN) {
-            advance(); // skip '='
-            expr = parseExpression();
-            if (!expr) {
-                errors.push_back("Invalid expression in declaration at line " + to_string(currentToken().line));
-                return nullptr;
-            }
-        }
-        if (currentToken().type != TokenType::SEMI) {
-            errors.push_back("Expected ';' at end of declaration at line " + to_string(currentToken().line));
-            return nullptr;
-        }
-        advance(); // skip ';'
+const char* nodeKindName(NodeKind kind) {
+    switch (kind) {
+        case NodeKind::Program: return "Program";
+        case NodeKind::Declaration: return "Declaration";
+        case NodeKind::BinaryExpr: return "BinaryExpr";
+        case NodeKind::Identifier: return "Identifier";
+        case NodeKind::NumberLiteral: return "NumberLiteral";
+        case NodeKind::StringLiteral: return "StringLiteral";
+        case NodeKind::Print: return "Print";
+        case NodeKind::IfElse: return "IfElse";
+        case NodeKind::Block: return "Block";
+        case NodeKind::Return: return "Return";
+    }
+    return "";
+}
+
+using NodeId = uint32_t;
+const NodeId NO_NODE = UINT32_MAX;
+
+// AST Node structure. Children are a contiguous range in AST::childIds.
+struct ASTNode {
+    NodeKind kind;
+    BinOp op = BinOp::ADD;   // BinaryExpr only
+    int symbol = -1;         // interned ID for Declaration/Identifier nodes
+    string_view value;       // view into the source buffer
+    uint32_t firstChild = 0;
+    uint32_t childCount = 0;
+};
+
+// Per-compilation AST arena. Nodes are bump-allocated into one vector and
+// referenced by index; clear() releases the whole tree at once.
+struct AST {
+    vector<ASTNode> nodes;
+    vector<NodeId> childIds;
+    NodeId root = NO_NODE;
 
-        auto decl = make_shared<ASTNode>("Declaration", varName);
-        if (expr) decl->addChild(expr);
-        return decl;
+    NodeId make(NodeKind kind, string_view value = "", int symbol = -1) {
+        ASTNode node;
+        node.kind = kind;
+        node.value = value;
+        node.symbol = symbol;
+        nodes.push_back(node);
+        return nodes.size() - 1;
     }
 
-    shared_ptr<ASTNode> parseExpression(int minPrec = 0) {
-        auto left = parsePrimary();
-        while (true) {
-            string op = currentToken().value;
-            int prec = getPrecedence(op);
-            if ((currentToken().type == TokenType::OP || currentToken().type == TokenType::COMPARE) && prec >= minPrec) {
-                advance();
-                auto right = parseExpression(prec + 1);
-                if (!right) return nullptr;
-                auto bin = make_shared<ASTNode>("BinaryExpr", op);
-                bin->addChild(left);
-                bin->addChild(right);
-                left = bin;
-            } else {
-                break;
-            }
-        }
-        return left;
+    // Children must be attached in one go so they stay contiguous
+    void setChildren(NodeId id, const NodeId* kids, size_t count) {
+        nodes[id].firstChild = childIds.size();
+        nodes[id].childCount = count;
+        childIds.insert(childIds.end(), kids, kids + count);
     }
 
-    shared_ptr<ASTNode> parsePrimary() {
-        if (currentToken().type == TokenType::ID) {
-            auto node = make_shared<ASTNode>("Identifier", currentToken().value);
-            advance();
-            return node;
-        }
-        else if (currentToken().type == TokenType::NUMBER) {
-            auto node = make_shared<ASTNode>("NumberLiteral", currentToken().value);
-            advance();
-            return node;
-        }
-        else {
-            errors.push_back("Expected identifier or number in expression");
-            return nullptr;
+    // Copies another arena's nodes in after these; returns the ID its
+    // node 0 now has, the offset for all of its IDs
+    NodeId append(const AST& part) {
+        NodeId base = nodes.size();
+        uint32_t childBase = childIds.size();
+        for (ASTNode node : part.nodes) {
+            node.firstChild += childBase;
+            nodes.push_back(node);
         }
+        for (NodeId child : part.childIds) childIds.push_back(child + base);
+        return base;
     }
 
-    int getPrecedence(const string& op) {
-        if (op == "==" || op == "!=" || op == "<" || op == ">" || op == "<=" || op == ">=") return 0;
-        if (op == "+" || op == "-") return 1;
-        if (op == "*" || op == "/") return 2;
-        return -1;
+    const ASTNode& operator[](NodeId id) const { return nodes[id]; }
+    NodeId child(NodeId id, size_t i) const { return childIds[nodes[id].firstChild + i]; }
+    const NodeId* childBegin(NodeId id) const { return childIds.data() + nodes[id].firstChild; }
+    const NodeId* childEnd(NodeId id) const { return childBegin(id) + nodes[id].childCount; }
+
+    void clear() {
+        nodes.clear();
+        childIds.clear();
+        root = NO_NODE;
     }
-    
 
-    Token& currentToken() { return tokens[currentTokenIndex]; }
-    void advance() { if (currentTokenIndex < tokens.size() - 1) ++currentTokenIndex; }
+    void print(ostream& out, NodeId id, int depth = 0) const {
+        vector<pair<NodeId, int>> pending{{id, depth}};
+        while (!pending.empty()) {
+            auto [next, level] = pending.back();
+            pending.pop_back();
+            const ASTNode& node = nodes[next];
+            writeIndent(out, 2 * min<size_t>(level, MAX_LISTING_DEPTH));
+            out << "└─ " << nodeKindName(node.kind);
+            if (!node.value.empty()) out << " (" << node.value << ")";
+            out << '\n';
+            for (uint32_t i = node.childCount; i-- > 0;) pending.push_back({child(next, i), level + 1});
+        }
+    }
 
-    void printTokens() const {
-        for (const auto& token : tokens) {
-            cout << "Line " << token.line << ", Column " << token.column << ": ";
-            switch (token.type) {
-                case TokenType::VAL:
-                case TokenType::PRT:
-                case TokenType::AGAR:
-                case TokenType::NHI_TO:
-                case TokenType::BHEJO:
-                    cout << "Keyword"; break;
-                case TokenType::ID: cout << "ID"; break;
-                case TokenType::NUMBER: cout << "NUMBER"; break;
-                case TokenType::STRING: cout << "STRING"; break;
-                case TokenType::OP: cout << "OP"; break;
-                case TokenType::COMPARE: cout << "COMPARE"; break;
-                case TokenType::ASSIGN: cout << "ASSIGN"; break;
-                case TokenType::LPAREN: cout << "LPAREN"; break;
-                case TokenType::RPAREN: cout << "RPAREN"; break;
-                case TokenType::LBRACE: cout << "LBRACE"; break;
-                case TokenType::RBRACE: cout << "RBRACE"; break;
-                case TokenType::SEMI: cout << "SEMI"; break;
-                case TokenType::END: cout << "END"; break;
-            }
-            cout << " = " << token.value << endl;
-        }
-    }
-
-    void semanticAnalysis(ASTNode* node) {
-        if (!node) return;
-        if (node->nodeType == "Program") {
-            for (const auto& child : node->children) {
-                semanticAnalysis(child.get());
-            }
-        }
-        else if (node->nodeType == "Declaration") {
-            if (symbolTable.find(node->value) != symbolTable.end()) {
-                errors.push_back("Variable '" + node->value + "' already declared.");
-            } else {
-                symbolTable[node->value] = "variable";
+    // JSON output for visualization. Nodes nested deeper than
+    // MAX_LISTING_DEPTH are not indented further, so the listing of a
+    // deep tree stays linear in its size.
+    void printJSON(ostream& out, NodeId id, int indent = 0) const {
+        // A node and the index of its next child to print
+        vector<pair<NodeId, uint32_t>> open;
+        auto begin = [&](NodeId next) {
+            const ASTNode& node = nodes[next];
+            size_t width = indent + 4 * min<size_t>(open.size(), MAX_LISTING_DEPTH);
+            writeIndent(out, width);
+            out << "{\n";
+            writeIndent(out, width + 2);
+            out << "\"type\": \"" << nodeKindName(node.kind) << "\"";
+            if (!node.value.empty()) {
+                out << ",\n";
+                writeIndent(out, width + 2);
+                out << "\"value\": \"";
+                JsonWriter::writeEscaped(out, node.value);
+                out << "\"";
             }
-            if (!node->children.empty()) {
-                semanticAnalysis(node->children[0].get());
+            if (node.childCount) {
+                out << ",\n";
+                writeIndent(out, width + 2);
+                out << "\"children\": [\n";
+            }
+            open.push_back({next, 0});
+        };
+
+        begin(id);
+        while (!open.empty()) {
+            auto& [next, printed] = open.back();
+            const ASTNode& node = nodes[next];
+            if (printed < node.childCount) {
+                if (printed) out << ",\n";
+                begin(child(next, printed++));
+                continue;
+            }
+            size_t width = indent + 4 * min<size_t>(open.size() - 1, MAX_LISTING_DEPTH);
+            if (node.childCount) {
+                out << "\n";
+                writeIndent(out, width + 2);
+                out << "]";
+            }
+            out << "\n";
+            writeIndent(out, width);
+            out << "}";
+            open.pop_back();
+        }
+    }
+
+    // Compact form of printJSON for the structured output mode
+    void writeJSON(JsonWriter& json, NodeId id) const {
+        vector<pair<NodeId, uint32_t>> open;
+        auto begin = [&](NodeId next) {
+            const ASTNode& node = nodes[next];
+            json.beginObject().key("type").value(nodeKindName(node.kind));
+            if (!node.value.empty()) json.key("value").value(node.value);
+            if (node.childCount) json.key("children").beginArray();
+            open.push_back({next, 0});
+        };
+
+        begin(id);
+        while (!open.empty()) {
+            auto& [next, written] = open.back();
+            const ASTNode& node = nodes[next];
+            if (written < node.childCount) {
+                begin(child(next, written++));
+                continue;
+            }
+            if (node.childCount) json.endArray();
+            json.endObject();
+            open.pop_back();
+        }
+    }
+
+private:
+    static constexpr size_t MAX_LISTING_DEPTH = 64;
+
+    static void writeIndent(ostream& out, size_t width) {
+        static const char spaces[] = "                                                                ";
+        for (; width > sizeof(spaces) - 1; width -= sizeof(spaces) - 1) out.write(spaces, sizeof(spaces) - 1);
+        out.write(spaces, width);
+    }
+};
+
+// --- Three-address code ---
+enum class OperandKind : uint8_t { NONE, CONST, VAR, TEMP, STRING };
+
+// A TAC operand: a constant value, a variable (symbol ID), a compiler
+// temporary (T<n>) or a string literal (index into TacProgram::strings).
+struct Operand {
+    OperandKind kind = OperandKind::NONE;
+    long long value = 0;
+
+    static Operand make(OperandKind k, long long v) {
+        Operand op;
+        op.kind = k;
+        op.value = v;
+        return op;
+    }
+
+    bool isConst() const { return kind == OperandKind::CONST; }
+    // Variables and temporaries are the operands that can be assigned
+    bool isStorage() const { return kind == OperandKind::VAR || kind == OperandKind::TEMP; }
+    // Dense key for hashing; kind in the low bits
+    long long key() const { return value * 8 + (long long)kind; }
+    bool operator==(const Operand& o) const { return kind == o.kind && value == o.value; }
+    bool operator!=(const Operand& o) const { return !(*this == o); }
+};
+
+enum class TacOp : uint8_t { ASSIGN, BINARY, IFNOT, GOTO, LABEL, PRINT, RETURN };
+
+// dst = a            (ASSIGN)
+// dst = a <binop> b  (BINARY)
+// ifnot a goto L     (IFNOT), goto L (GOTO), L: (LABEL)
+// print a, return a  (PRINT, RETURN)
+struct TacInstr {
+    TacOp op;
+    BinOp binop = BinOp::ADD;
+    Operand dst, a, b;
+    int label = -1;
+
+    bool definesValue() const { return op == TacOp::ASSIGN || op == TacOp::BINARY; }
+
+    template <typename F>
+    void forEachUse(F f) {
+        switch (op) {
+            case TacOp::BINARY: f(a); f(b); break;
+            case TacOp::ASSIGN: case TacOp::IFNOT: case TacOp::PRINT: case TacOp::RETURN: f(a); break;
+            default: break;
+        }
+    }
+
+    template <typename F>
+    void forEachUse(F f) const {
+        switch (op) {
+            case TacOp::BINARY: f(a); f(b); break;
+            case TacOp::ASSIGN: case TacOp::IFNOT: case TacOp::PRINT: case TacOp::RETURN: f(a); break;
+            default: break;
+        }
+    }
+
+    // Literals outside the int range trap when evaluated, like in the VM
+    bool hasOutOfRangeConstant() const {
+        bool found = false;
+        forEachUse([&](const Operand& use) {
+            if (use.isConst() && (use.value < INT_MIN || use.value > INT_MAX)) found = true;
+        });
+        return found;
+    }
+};
+
+struct TacProgram {
+    vector<TacInstr> code;
+    vector<string_view> strings;        // string literals, quotes included
+    const SymbolTable* symbols = nullptr;   // names of the variable slots
+    int counter = 0;                     // shared numbering of temps and labels
+    unordered_map<long long, string_view> literalText;   // out-of-range literals as written
+
+    int newTemp() { return ++counter; }
+    int newLabel() { return ++counter; }
+
+    string format(const Operand& op) const {
+        switch (op.kind) {
+            case OperandKind::CONST: return to_string(op.value);
+            case OperandKind::VAR: return symbols->label(op.value);
+            case OperandKind::TEMP: return "T" + to_string(op.value);
+            case OperandKind::STRING: return string(strings[op.value]);
+            default: return "";
+        }
+    }
+
+    string format(const TacInstr& ins) const {
+        switch (ins.op) {
+            case TacOp::ASSIGN: return format(ins.dst) + " = " + format(ins.a);
+            case TacOp::BINARY:
+                return format(ins.dst) + " = " + format(ins.a) + " " + binOpSymbol(ins.binop) + " " + format(ins.b);
+            case TacOp::IFNOT: return "ifnot " + format(ins.a) + " goto L" + to_string(ins.label);
+            case TacOp::GOTO: return "goto L" + to_string(ins.label);
+            case TacOp::LABEL: return "L" + to_string(ins.label) + ":";
+            case TacOp::PRINT: return "print " + format(ins.a);
+            case TacOp::RETURN: return "return " + format(ins.a);
+        }
+        return "";
+    }
+};
+
+// Lowers the AST to TAC in source order
+class TacBuilder {
+    const AST& ast;
+    const vector<int>& slots;             // node ID -> slot of the variable it names
+    TacProgram& tac;
+
+    void emit(TacOp op, Operand dst = Operand(), Operand a = Operand(), Operand b = Operand(), int label = -1) {
+        TacInstr ins;
+        ins.op = op;
+        ins.dst = dst;
+        ins.a = a;
+        ins.b = b;
+        ins.label = label;
+        tac.code.push_back(ins);
+    }
+
+    // A block or agar being lowered and how far it has got: the next child
+    // of a block, or for agar which of its blocks has been emitted
+    struct Frame {
+        NodeId id;
+        uint32_t stage;
+        int labelElse, labelEnd;
+    };
+    vector<Frame> frames;
+    vector<pair<NodeId, bool>> pending;   // operators, and whether their left operand is done
+    vector<Operand> operands;             // left operands waiting for the right one
+
+    Operand leaf(NodeId id) {
+        const ASTNode& node = ast[id];
+        switch (node.kind) {
+            case NodeKind::NumberLiteral: {
+                // Too large even for long long: still out of int range, so it traps
+                long long value = 0;
+                auto res = from_chars(node.value.data(), node.value.data() + node.value.size(), value);
+                if (res.ec != errc()) value = LLONG_MAX;
+                Operand literal = Operand::make(OperandKind::CONST, value);
+                if (value >= INT_MIN && value <= INT_MAX) return literal;
+                // Load it here so it traps where the VM evaluates it
+                tac.literalText.emplace(value, node.value);
+                Operand temp = Operand::make(OperandKind::TEMP, tac.newTemp());
+                emit(TacOp::ASSIGN, temp, literal);
+                return temp;
+            }
+            case NodeKind::Identifier:
+                return Operand::make(OperandKind::VAR, slots[id]);
+            case NodeKind::StringLiteral:
+                tac.strings.push_back(node.value);
+                return Operand::make(OperandKind::STRING, tac.strings.size() - 1);
+            default:
+                return Operand();
+        }
+    }
+
+    // Lowers the expression in post-order, left operand first
+    Operand expression(NodeId id) {
+        NodeId next = id;
+        for (;;) {
+            while (ast[next].kind == NodeKind::BinaryExpr) {
+                pending.push_back({next, false});
+                next = ast.child(next, 0);
+            }
+            Operand value = leaf(next);
+            // Emit every operator whose right operand this value completes
+            for (;;) {
+                if (pending.empty()) return value;
+                auto& [op, leftDone] = pending.back();
+                if (!leftDone) {
+                    leftDone = true;
+                    operands.push_back(value);
+                    next = ast.child(op, 1);
+                    break;
+                }
+                Operand result = Operand::make(OperandKind::TEMP, tac.newTemp());
+                emit(TacOp::BINARY, result, operands.back(), value);
+                tac.code.back().binop = ast[op].op;
+                operands.pop_back();
+                pending.pop_back();
+                value = result;
+            }
+        }
+    }
+
+    // Lowers a statement that holds no other statements
+    void simpleStatement(NodeId id) {
+        const ASTNode& node = ast[id];
+        switch (node.kind) {
+            case NodeKind::Declaration: {
+                Operand value = node.childCount ? expression(ast.child(id, 0)) : Operand::make(OperandKind::CONST, 0);
+                emit(TacOp::ASSIGN, Operand::make(OperandKind::VAR, slots[id]), value);
+                break;
+            }
+            case NodeKind::Return:
+                if (node.childCount) emit(TacOp::RETURN, Operand(), expression(ast.child(id, 0)));
+                break;
+            case NodeKind::Print:
+                if (node.childCount) emit(TacOp::PRINT, Operand(), expression(ast.child(id, 0)));
+                break;
+            default:
+                break;
+        }
+    }
+
+    static bool nests(NodeKind kind) {
+        return kind == NodeKind::Program || kind == NodeKind::Block || kind == NodeKind::IfElse;
+    }
+
+    void statement(NodeId id) {
+        if (!nests(ast[id].kind)) return simpleStatement(id);
+        frames.assign(1, {id, 0, -1, -1});
+        while (!frames.empty()) {
+            Frame& frame = frames.back();
+            const ASTNode& node = ast[frame.id];
+            NodeId next = NO_NODE;
+            if (node.kind != NodeKind::IfElse) {
+                if (frame.stage < node.childCount) next = ast.child(frame.id, frame.stage++);
+            } else if (frame.stage == 0) {
+                Operand cond = expression(ast.child(frame.id, 0));
+                frame.labelElse = tac.newLabel();
+                frame.labelEnd = tac.newLabel();
+                emit(TacOp::IFNOT, Operand(), cond, Operand(), frame.labelElse);
+                frame.stage = 1;
+                next = ast.child(frame.id, 1);
+            } else if (frame.stage == 1) {
+                emit(TacOp::GOTO, Operand(), Operand(), Operand(), frame.labelEnd);
+                emit(TacOp::LABEL, Operand(), Operand(), Operand(), frame.labelElse);
+                frame.stage = 2;
+                if (node.childCount > 2) next = ast.child(frame.id, 2);
+                else continue;
+            } else {
+                emit(TacOp::LABEL, Operand(), Operand(), Operand(), frame.labelEnd);
+            }
+
+            if (next == NO_NODE) frames.pop_back();
+            else if (nests(ast[next].kind)) frames.push_back({next, 0, -1, -1});
+            else simpleStatement(next);
+        }
+    }
+
+public:
+    TacBuilder(const AST& tree, const vector<int>& nodeSlots, TacProgram& out)
+        : ast(tree), slots(nodeSlots), tac(out) {}
+
+    void build(NodeId root) {
+        if (root != NO_NODE) statement(root);
+    }
+};
+
+// --- TAC optimization passes ---
+// Each pass rewrites the program in place and returns whether it changed
+// anything. Instructions are deleted by marking them and compacting once.
+
+// A maximal straight-line run of instructions [begin, end)
+struct BasicBlock {
+    size_t begin, end;
+    vector<size_t> succs;
+};
+
+// Splits the code at labels and after jumps, and links the blocks
+vector<BasicBlock> splitBasicBlocks(const vector<TacInstr>& code) {
+    vector<BasicBlock> blocks;
+    unordered_map<int, size_t> labelBlock;
+    size_t start = 0;
+    for (size_t i = 0; i < code.size(); ++i) {
+        if (code[i].op == TacOp::LABEL && i > start) {
+            blocks.push_back({start, i, {}});
+            start = i;
+        }
+        if (code[i].op == TacOp::LABEL) labelBlock[code[i].label] = blocks.size();
+        if (code[i].op == TacOp::IFNOT || code[i].op == TacOp::GOTO) {
+            blocks.push_back({start, i + 1, {}});
+            start = i + 1;
+        }
+    }
+    if (start < code.size()) blocks.push_back({start, code.size(), {}});
+
+    for (size_t b = 0; b < blocks.size(); ++b) {
+        const TacInstr& last = code[blocks[b].end - 1];
+        if (last.op == TacOp::GOTO || last.op == TacOp::IFNOT) {
+            blocks[b].succs.push_back(labelBlock[last.label]);
+        }
+        if (last.op != TacOp::GOTO && b + 1 < blocks.size()) {
+            blocks[b].succs.push_back(b + 1);
+        }
+    }
+    return blocks;
+}
+
+static void removeMarked(vector<TacInstr>& code, const vector<bool>& dead) {
+    size_t out = 0;
+    for (size_t i = 0; i < code.size(); ++i) {
+        if (!dead[i]) code[out++] = code[i];
+    }
+    code.resize(out);
+}
+
+// Folds with the VM's 32-bit wrapping semantics; false if the operation
+// would trap at run time or an operand is outside the int range
+bool foldBinary(BinOp op, long long left, long long right, long long& out) {
+    if (left < INT_MIN || left > INT_MAX || right < INT_MIN || right > INT_MAX) return false;
+    unsigned ul = (unsigned)left, ur = (unsigned)right;
+    int l = left, r = right;
+    switch (op) {
+        case BinOp::ADD: out = (int)(ul + ur); return true;
+        case BinOp::SUB: out = (int)(ul - ur); return true;
+        case BinOp::MUL: out = (int)(ul * ur); return true;
+        case BinOp::DIV:
+            if (r == 0 || (l == INT_MIN && r == -1)) return false;
+            out = l / r; return true;
+        case BinOp::EQ: out = l == r; return true;
+        case BinOp::NE: out = l != r; return true;
+        case BinOp::LT: out = l < r; return true;
+        case BinOp::LE: out = l <= r; return true;
+        case BinOp::GT: out = l > r; return true;
+        case BinOp::GE: out = l >= r; return true;
+    }
+    return false;
+}
+
+// Propagates constants through each block, folds constant operations and
+// resolves 'ifnot' on a constant to a plain jump or nothing
+bool constantFolding(TacProgram& tac) {
+    bool changed = false;
+    vector<bool> dead(tac.code.size(), false);
+    unordered_map<long long, long long> known;   // operand key -> constant
+    for (size_t i = 0; i < tac.code.size(); ++i) {
+        TacInstr& ins = tac.code[i];
+        if (ins.op == TacOp::LABEL) {
+            known.clear();
+            continue;
+        }
+        ins.forEachUse([&](Operand& use) {
+            if (!use.isStorage()) return;
+            auto it = known.find(use.key());
+            if (it != known.end()) {
+                use = Operand::make(OperandKind::CONST, it->second);
+                changed = true;
+            }
+        });
+        long long folded;
+        if (ins.op == TacOp::BINARY && ins.a.isConst() && ins.b.isConst() &&
+            foldBinary(ins.binop, ins.a.value, ins.b.value, folded)) {
+            ins.op = TacOp::ASSIGN;
+            ins.a = Operand::make(OperandKind::CONST, folded);
+            ins.b = Operand();
+            changed = true;
+        }
+        if (ins.op == TacOp::IFNOT && ins.a.isConst() && !ins.hasOutOfRangeConstant()) {
+            if (ins.a.value) dead[i] = true;
+            else ins.op = TacOp::GOTO;
+            ins.a = Operand();
+            changed = true;
+        }
+        if (ins.definesValue()) {
+            if (ins.op == TacOp::ASSIGN && ins.a.isConst()) known[ins.dst.key()] = ins.a.value;
+            else known.erase(ins.dst.key());
+        }
+    }
+    removeMarked(tac.code, dead);
+    return changed;
+}
+
+// Replaces uses of x after 'x = y' with y until either is reassigned or
+// the basic block ends
+bool copyPropagation(TacProgram& tac) {
+    bool changed = false;
+    unordered_map<long long, Operand> copyOf;              // dst key -> source
+    unordered_map<long long, vector<long long>> copiesFrom; // source key -> dst keys
+    auto kill = [&](const Operand& def) {
+        copyOf.erase(def.key());
+        auto it = copiesFrom.find(def.key());
+        if (it == copiesFrom.end()) return;
+        for (long long dst : it->second) {
+            auto c = copyOf.find(dst);
+            if (c != copyOf.end() && c->second == def) copyOf.erase(c);
+        }
+        copiesFrom.erase(it);
+    };
+    for (TacInstr& ins : tac.code) {
+        if (ins.op == TacOp::LABEL) {
+            copyOf.clear();
+            copiesFrom.clear();
+            continue;
+        }
+        ins.forEachUse([&](Operand& use) {
+            if (!use.isStorage()) return;
+            auto it = copyOf.find(use.key());
+            if (it != copyOf.end()) {
+                use = it->second;
+                changed = true;
+            }
+        });
+        // Stop at the end of the block too: a temporary must not be
+        // carried into the fall-through block
+        if (ins.op == TacOp::IFNOT || ins.op == TacOp::GOTO) {
+            copyOf.clear();
+            copiesFrom.clear();
+            continue;
+        }
+        if (ins.definesValue()) {
+            kill(ins.dst);
+            if (ins.op == TacOp::ASSIGN && ins.a.isStorage() && ins.a != ins.dst) {
+                copyOf[ins.dst.key()] = ins.a;
+                copiesFrom[ins.a.key()].push_back(ins.dst.key());
+            }
+        }
+    }
+    return changed;
+}
+
+// Local common-subexpression elimination by value numbering: a binary
+// operation whose operands carry the same value numbers as an earlier one
+// in the block becomes a copy of the operand still holding that value.
+bool localValueNumbering(TacProgram& tac) {
+    bool changed = false;
+    unordered_map<long long, int> operandVN;   // operand key -> value number
+    unordered_map<long long, int> constVN;     // constant -> value number
+    unordered_map<uint64_t, int> exprVN;       // (op, vn, vn) -> value number
+    vector<Operand> holder;                    // value number -> an operand holding it
+    int nextVN = 0;
+
+    auto newVN = [&](const Operand& holding) {
+        holder.push_back(holding);
+        return nextVN++;
+    };
+    auto vnOf = [&](const Operand& op) {
+        if (op.isConst()) {
+            auto it = constVN.find(op.value);
+            if (it != constVN.end()) return it->second;
+            return constVN[op.value] = newVN(op);
+        }
+        auto it = operandVN.find(op.key());
+        if (it != operandVN.end()) return it->second;
+        return operandVN[op.key()] = newVN(op);
+    };
+    auto holds = [&](const Operand& op, int vn) {
+        if (op.isConst()) return true;
+        auto it = operandVN.find(op.key());
+        return it != operandVN.end() && it->second == vn;
+    };
+
+    for (TacInstr& ins : tac.code) {
+        // Numbering is per basic block, like temporaries
+        if (ins.op == TacOp::LABEL || ins.op == TacOp::IFNOT || ins.op == TacOp::GOTO) {
+            operandVN.clear();
+            exprVN.clear();
+            continue;
+        }
+        if (ins.op == TacOp::ASSIGN) {
+            int vn = vnOf(ins.a);
+            operandVN[ins.dst.key()] = vn;
+        } else if (ins.op == TacOp::BINARY) {
+            uint64_t left = vnOf(ins.a), right = vnOf(ins.b);
+            bool commutative = ins.binop == BinOp::ADD || ins.binop == BinOp::MUL ||
+                               ins.binop == BinOp::EQ || ins.binop == BinOp::NE;
+            if (commutative && right < left) swap(left, right);
+            uint64_t key = (uint64_t)ins.binop << 56 | left << 28 | right;
+            auto it = exprVN.find(key);
+            if (it != exprVN.end() && holds(holder[it->second], it->second) && holder[it->second] != ins.dst) {
+                ins.op = TacOp::ASSIGN;
+                ins.a = holder[it->second];
+                ins.b = Operand();
+                operandVN[ins.dst.key()] = it->second;
+                changed = true;
+            } else {
+                int vn = newVN(ins.dst);
+                exprVN[key] = vn;
+                operandVN[ins.dst.key()] = vn;
+            }
+        }
+    }
+    return changed;
+}
+
+// Variable liveness over the block graph, one bitset per block. Only
+// variables are tracked: temporaries never outlive their block.
+struct VarLiveness {
+    vector<vector<uint64_t>> liveIn, liveOut;
+
+    static bool test(const vector<uint64_t>& set, long long v) { return (set[v / 64] >> (v % 64)) & 1; }
+};
+
+VarLiveness computeVarLiveness(const vector<TacInstr>& code, const vector<BasicBlock>& blocks, size_t symbolCount) {
+    size_t words = (symbolCount + 63) / 64;
+    VarLiveness result;
+    vector<vector<uint64_t>>& liveIn = result.liveIn;
+    vector<vector<uint64_t>>& liveOut = result.liveOut;
+    liveIn.assign(blocks.size(), vector<uint64_t>(words, 0));
+    liveOut.assign(blocks.size(), vector<uint64_t>(words, 0));
+    vector<vector<uint64_t>> uses(blocks.size(), vector<uint64_t>(words, 0));
+    vector<vector<uint64_t>> defs(blocks.size(), vector<uint64_t>(words, 0));
+    auto setBit = [](vector<uint64_t>& set, long long v) { set[v / 64] |= 1ULL << (v % 64); };
+
+    for (size_t b = 0; b < blocks.size(); ++b) {
+        for (size_t i = blocks[b].begin; i < blocks[b].end; ++i) {
+            code[i].forEachUse([&](const Operand& use) {
+                if (use.kind == OperandKind::VAR && !VarLiveness::test(defs[b], use.value)) setBit(uses[b], use.value);
+            });
+            if (code[i].definesValue() && code[i].dst.kind == OperandKind::VAR) setBit(defs[b], code[i].dst.value);
+        }
+        liveIn[b] = uses[b];
+    }
+    for (bool again = true; again; ) {
+        again = false;
+        for (size_t b = blocks.size(); b-- > 0; ) {
+            for (size_t w = 0; w < words; ++w) {
+                uint64_t out = 0;
+                for (size_t s : blocks[b].succs) out |= liveIn[s][w];
+                uint64_t in = uses[b][w] | (out & ~defs[b][w]);
+                liveOut[b][w] = out;
+                if (in != liveIn[b][w]) {
+                    liveIn[b][w] = in;
+                    again = true;
+                }
+            }
+        }
+    }
+    return result;
+}
+
+// Removes unreachable code, jumps to the next instruction, unused labels
+// and assignments whose value is never read. Variable liveness is solved
+// over the basic-block graph; temporaries never outlive their block.
+bool deadCodeElimination(TacProgram& tac) {
+    bool changed = false;
+    vector<TacInstr>& code = tac.code;
+
+    // Control-flow cleanup, repeated until nothing more falls out
+    for (bool again = true; again; ) {
+        again = false;
+        vector<bool> dead(code.size(), false);
+
+        // Adjacent labels name the same point; jumps use the first one
+        unordered_map<int, int> alias;
+        for (size_t i = 1; i < code.size(); ++i) {
+            if (code[i].op == TacOp::LABEL && code[i - 1].op == TacOp::LABEL) {
+                auto it = alias.find(code[i - 1].label);
+                alias[code[i].label] = it != alias.end() ? it->second : code[i - 1].label;
+            }
+        }
+        for (TacInstr& ins : code) {
+            if (ins.op != TacOp::GOTO && ins.op != TacOp::IFNOT) continue;
+            auto it = alias.find(ins.label);
+            if (it != alias.end()) ins.label = it->second;
+        }
+
+        unordered_map<int, int> labelUses;
+        bool reachable = true;
+        for (size_t i = 0; i < code.size(); ++i) {
+            if (code[i].op == TacOp::LABEL) reachable = true;
+            if (!reachable) {
+                dead[i] = true;
+                continue;
+            }
+            bool jump = code[i].op == TacOp::GOTO || code[i].op == TacOp::IFNOT;
+            if (code[i].op == TacOp::GOTO) reachable = false;
+            if (jump && i + 1 < code.size() && code[i + 1].op == TacOp::LABEL && code[i + 1].label == code[i].label &&
+                !code[i].hasOutOfRangeConstant()) {
+                dead[i] = true;
+                continue;
+            }
+            if (code[i].op == TacOp::GOTO || code[i].op == TacOp::IFNOT) labelUses[code[i].label]++;
+        }
+        for (size_t i = 0; i < code.size(); ++i) {
+            if (!dead[i] && code[i].op == TacOp::LABEL && !labelUses.count(code[i].label)) dead[i] = true;
+        }
+        for (size_t i = 0; i < code.size(); ++i) {
+            if (dead[i]) again = changed = true;
+        }
+        removeMarked(code, dead);
+    }
+
+    vector<BasicBlock> blocks = splitBasicBlocks(code);
+    VarLiveness liveness = computeVarLiveness(code, blocks, tac.symbols->size());
+    auto test = VarLiveness::test;
+    auto setBit = [](vector<uint64_t>& set, long long v) { set[v / 64] |= 1ULL << (v % 64); };
+    auto clearBit = [](vector<uint64_t>& set, long long v) { set[v / 64] &= ~(1ULL << (v % 64)); };
+
+    vector<bool> dead(code.size(), false);
+    unordered_set<long long> liveTemps;
+    for (size_t b = 0; b < blocks.size(); ++b) {
+        vector<uint64_t> live = liveness.liveOut[b];
+        liveTemps.clear();
+        for (size_t i = blocks[b].end; i-- > blocks[b].begin; ) {
+            TacInstr& ins = code[i];
+            if (ins.definesValue()) {
+                bool isLive = ins.dst.kind == OperandKind::VAR ? test(live, ins.dst.value)
+                                                               : liveTemps.count(ins.dst.value) > 0;
+                // A division or literal that may trap is kept for its side effect
+                bool mayTrap = (ins.op == TacOp::BINARY && ins.binop == BinOp::DIV &&
+                                !(ins.b.isConst() && ins.b.value != 0 && ins.b.value != -1)) ||
+                               ins.hasOutOfRangeConstant();
+                if (!isLive && !mayTrap) {
+                    dead[i] = changed = true;
+                    continue;
+                }
+                if (ins.dst.kind == OperandKind::VAR) clearBit(live, ins.dst.value);
+                else liveTemps.erase(ins.dst.value);
+            }
+            ins.forEachUse([&](Operand& use) {
+                if (use.kind == OperandKind::VAR) setBit(live, use.value);
+                else if (use.kind == OperandKind::TEMP) liveTemps.insert(use.value);
+            });
+        }
+    }
+    removeMarked(code, dead);
+    return changed;
+}
+
+// --- Control-flow graph and SSA ---
+// SsaForm is built next to an unchanged TacProgram: it records the block
+// graph, the dominator tree, phi nodes and, for every instruction, the
+// SSA name each operand reads or writes. Global passes analyse the SSA
+// names and then rewrite the ordinary TAC, so no out-of-SSA step is needed.
+struct SsaForm {
+    struct Edge { size_t from, to; };
+    struct Phi {
+        size_t block;
+        int storage;
+        int dst;
+        vector<int> args;            // parallel to inEdges[block]
+    };
+
+    vector<BasicBlock> blocks;
+    vector<Edge> edges;
+    vector<vector<size_t>> inEdges, outEdges;   // outEdges follow BasicBlock::succs order
+    vector<size_t> blockOf;                      // instruction -> block
+    vector<int> idom;                            // -1 for the entry and unreachable blocks
+    vector<vector<size_t>> domChildren;
+    vector<Phi> phis;
+    vector<vector<size_t>> blockPhis;
+
+    // SSA names. Names below storageCount are the entry values (0) of each
+    // variable and temporary; the rest are phi or instruction results.
+    size_t storageCount = 0;
+    size_t symbolCount = 0;
+    vector<int> nameStorage;
+    vector<int> nameBlock;                       // defining block, -1 for entry values
+    vector<array<int, 2>> useName;               // per instruction: names read by a and b
+    vector<int> defName;                         // per instruction: name written, or -1
+
+    int storageOf(const Operand& op) const {
+        if (op.kind == OperandKind::VAR) return op.value;
+        if (op.kind == OperandKind::TEMP) return symbolCount + op.value;
+        return -1;
+    }
+
+    Operand operandOf(int storage) const {
+        if ((size_t)storage < symbolCount) return Operand::make(OperandKind::VAR, storage);
+        return Operand::make(OperandKind::TEMP, storage - symbolCount);
+    }
+
+    bool reachable(size_t block) const { return block == 0 || idom[block] >= 0; }
+};
+
+// Dominator tree by Lengauer-Tarjan with path compression. Both the DFS
+// and the compression are iterative, so deeply nested branches are fine.
+static void computeDominators(SsaForm& ssa) {
+    size_t n = ssa.blocks.size();
+    ssa.idom.assign(n, -1);
+    ssa.domChildren.assign(n, {});
+    if (n == 0) return;
+
+    vector<int> dfnum(n, -1), vertex, parent(n, -1);
+    vector<pair<size_t, size_t>> stack = {{0, 0}};
+    dfnum[0] = 0;
+    vertex.push_back(0);
+    while (!stack.empty()) {
+        auto& top = stack.back();
+        size_t b = top.first;
+        if (top.second == ssa.outEdges[b].size()) {
+            stack.pop_back();
+            continue;
+        }
+        size_t s = ssa.edges[ssa.outEdges[b][top.second++]].to;
+        if (dfnum[s] >= 0) continue;
+        dfnum[s] = vertex.size();
+        vertex.push_back(s);
+        parent[s] = b;
+        stack.push_back({s, 0});
+    }
+
+    // Everything below works on DFS numbers
+    size_t count = vertex.size();
+    vector<int> semi(count), label(count), ancestor(count, -1), idomNum(count, 0), parentNum(count, -1);
+    vector<vector<int>> bucket(count);
+    for (size_t i = 0; i < count; ++i) {
+        semi[i] = label[i] = i;
+        if (i) parentNum[i] = dfnum[parent[vertex[i]]];
+    }
+    vector<int> path;
+    auto eval = [&](int v) {
+        if (ancestor[v] < 0) return v;
+        path.clear();
+        for (int x = v; ancestor[ancestor[x]] >= 0; x = ancestor[x]) path.push_back(x);
+        for (size_t k = path.size(); k-- > 0; ) {
+            int x = path[k];
+            if (semi[label[ancestor[x]]] < semi[label[x]]) label[x] = label[ancestor[x]];
+            ancestor[x] = ancestor[ancestor[x]];
+        }
+        return label[v];
+    };
+
+    for (size_t i = count; i-- > 1; ) {
+        int w = i;
+        for (size_t e : ssa.inEdges[vertex[w]]) {
+            int v = dfnum[ssa.edges[e].from];
+            if (v < 0) continue;
+            int u = eval(v);
+            if (semi[u] < semi[w]) semi[w] = semi[u];
+        }
+        bucket[semi[w]].push_back(w);
+        ancestor[w] = parentNum[w];
+        for (int v : bucket[parentNum[w]]) {
+            int u = eval(v);
+            idomNum[v] = semi[u] < semi[v] ? u : parentNum[w];
+        }
+        bucket[parentNum[w]].clear();
+    }
+    for (size_t i = 1; i < count; ++i) {
+        if (idomNum[i] != semi[i]) idomNum[i] = idomNum[idomNum[i]];
+        ssa.idom[vertex[i]] = vertex[idomNum[i]];
+        ssa.domChildren[vertex[idomNum[i]]].push_back(vertex[i]);
+    }
+}
+
+// Builds the CFG, dominator tree and semi-pruned SSA form of 'tac'
+SsaForm buildSsa(const TacProgram& tac) {
+    SsaForm ssa;
+    const vector<TacInstr>& code = tac.code;
+    ssa.blocks = splitBasicBlocks(code);
+    size_t n = ssa.blocks.size();
+    ssa.symbolCount = tac.symbols->size();
+    ssa.storageCount = ssa.symbolCount + tac.counter + 1;
+
+    ssa.inEdges.assign(n, {});
+    ssa.outEdges.assign(n, {});
+    ssa.blockOf.assign(code.size(), 0);
+    for (size_t b = 0; b < n; ++b) {
+        for (size_t i = ssa.blocks[b].begin; i < ssa.blocks[b].end; ++i) ssa.blockOf[i] = b;
+        for (size_t s : ssa.blocks[b].succs) {
+            ssa.outEdges[b].push_back(ssa.edges.size());
+            ssa.inEdges[s].push_back(ssa.edges.size());
+            ssa.edges.push_back({b, s});
+        }
+    }
+    computeDominators(ssa);
+
+    // Dominance frontiers, walking up from each predecessor of a join
+    vector<vector<size_t>> frontier(n);
+    for (size_t b = 0; b < n; ++b) {
+        if (ssa.inEdges[b].size() < 2 || !ssa.reachable(b)) continue;
+        for (size_t e : ssa.inEdges[b]) {
+            size_t runner = ssa.edges[e].from;
+            if (!ssa.reachable(runner)) continue;
+            while ((int)runner != ssa.idom[b]) {
+                if (frontier[runner].empty() || frontier[runner].back() != b) frontier[runner].push_back(b);
+                if (ssa.idom[runner] < 0) break;
+                runner = ssa.idom[runner];
+            }
+        }
+    }
+
+    // Only storage read before being written in some block needs phis
+    vector<vector<size_t>> defBlocks(ssa.storageCount);
+    vector<bool> global(ssa.storageCount, false);
+    vector<int> definedIn(ssa.storageCount, -1);
+    for (size_t b = 0; b < n; ++b) {
+        for (size_t i = ssa.blocks[b].begin; i < ssa.blocks[b].end; ++i) {
+            const TacInstr& ins = code[i];
+            ins.forEachUse([&](const Operand& use) {
+                int s = ssa.storageOf(use);
+                if (s >= 0 && definedIn[s] != (int)b) global[s] = true;
+            });
+            if (ins.definesValue()) {
+                int s = ssa.storageOf(ins.dst);
+                if (definedIn[s] != (int)b) defBlocks[s].push_back(b);
+                definedIn[s] = b;
+            }
+        }
+    }
+
+    ssa.blockPhis.assign(n, {});
+    vector<int> hasPhi(n, -1), queued(n, -1);
+    vector<size_t> work;
+    for (size_t s = 0; s < ssa.storageCount; ++s) {
+        if (!global[s]) continue;
+        work = defBlocks[s];
+        for (size_t b : work) queued[b] = s;
+        while (!work.empty()) {
+            size_t b = work.back();
+            work.pop_back();
+            for (size_t d : frontier[b]) {
+                if (hasPhi[d] == (int)s) continue;
+                hasPhi[d] = s;
+                ssa.blockPhis[d].push_back(ssa.phis.size());
+                ssa.phis.push_back({d, (int)s, -1, vector<int>(ssa.inEdges[d].size(), (int)s)});
+                if (queued[d] != (int)s) {
+                    queued[d] = s;
+                    work.push_back(d);
+                }
+            }
+        }
+    }
+
+    // Renaming over the dominator tree with one version stack per storage
+    for (size_t s = 0; s < ssa.storageCount; ++s) {
+        ssa.nameStorage.push_back(s);
+        ssa.nameBlock.push_back(-1);
+    }
+    auto newName = [&](int storage, size_t block) {
+        ssa.nameStorage.push_back(storage);
+        ssa.nameBlock.push_back(block);
+        return (int)ssa.nameStorage.size() - 1;
+    };
+    ssa.useName.assign(code.size(), {-1, -1});
+    ssa.defName.assign(code.size(), -1);
+    vector<vector<int>> current(ssa.storageCount);
+    auto top = [&](int s) { return current[s].empty() ? s : current[s].back(); };
+    vector<int> pushed;                      // storage pushed, unwound on exit
+    vector<pair<size_t, bool>> stack = {{0, false}};
+    vector<size_t> marks;
+    while (n && !stack.empty()) {
+        auto [b, exiting] = stack.back();
+        stack.pop_back();
+        if (exiting) {
+            size_t mark = marks.back();
+            marks.pop_back();
+            while (pushed.size() > mark) {
+                current[pushed.back()].pop_back();
+                pushed.pop_back();
+            }
+            continue;
+        }
+        marks.push_back(pushed.size());
+        stack.push_back({b, true});
+
+        for (size_t p : ssa.blockPhis[b]) {
+            ssa.phis[p].dst = newName(ssa.phis[p].storage, b);
+            current[ssa.phis[p].storage].push_back(ssa.phis[p].dst);
+            pushed.push_back(ssa.phis[p].storage);
+        }
+        for (size_t i = ssa.blocks[b].begin; i < ssa.blocks[b].end; ++i) {
+            const TacInstr& ins = code[i];
+            int a = ssa.storageOf(ins.a), bb = ssa.storageOf(ins.b);
+            if (a >= 0) ssa.useName[i][0] = top(a);
+            if (bb >= 0) ssa.useName[i][1] = top(bb);
+            if (ins.definesValue()) {
+                int s = ssa.storageOf(ins.dst);
+                ssa.defName[i] = newName(s, b);
+                current[s].push_back(ssa.defName[i]);
+                pushed.push_back(s);
+            }
+        }
+        for (size_t e : ssa.outEdges[b]) {
+            size_t succ = ssa.edges[e].to;
+            const vector<size_t>& in = ssa.inEdges[succ];
+            size_t slot = find(in.begin(), in.end(), e) - in.begin();
+            for (size_t p : ssa.blockPhis[succ]) ssa.phis[p].args[slot] = top(ssa.phis[p].storage);
+        }
+        for (size_t c : ssa.domChildren[b]) stack.push_back({c, false});
+    }
+    return ssa;
+}
+
+// Sparse conditional constant propagation (Wegman-Zadeck). Values only
+// flow along edges proven executable, so an agar whose condition is
+// constant loses its dead branch and phis see only the live arm.
+bool sparseConditionalConstants(TacProgram& tac) {
+    SsaForm ssa = buildSsa(tac);
+    vector<TacInstr>& code = tac.code;
+    if (code.empty()) return false;
+
+    enum Lattice : uint8_t { TOP, CONST, BOTTOM };
+    size_t names = ssa.nameStorage.size();
+    vector<Lattice> state(names, TOP);
+    vector<long long> value(names, 0);
+    for (size_t s = 0; s < ssa.storageCount; ++s) state[s] = CONST;   // variables start at 0
+
+    // Def-use chains: instruction index, or ~phi for phi uses
+    vector<vector<long long>> users(names);
+    for (size_t i = 0; i < code.size(); ++i) {
+        for (int u : ssa.useName[i]) if (u >= 0) users[u].push_back(i);
+    }
+    for (size_t p = 0; p < ssa.phis.size(); ++p) {
+        for (int u : ssa.phis[p].args) users[u].push_back(~(long long)p);
+    }
+
+    vector<bool> edgeLive(ssa.edges.size(), false), blockLive(ssa.blocks.size(), false);
+    vector<size_t> flowWork;
+    vector<int> ssaWork;
+
+    auto lower = [&](int name, Lattice s, long long v) {
+        if (state[name] == BOTTOM || (state[name] == s && (s != CONST || value[name] == v))) return;
+        if (state[name] == CONST && s == CONST) s = BOTTOM;     // two different constants
+        state[name] = s;
+        value[name] = v;
+        ssaWork.push_back(name);
+    };
+    auto operandState = [&](const Operand& op, int name, long long& v) {
+        if (op.isConst()) {
+            v = op.value;
+            return op.value < INT_MIN || op.value > INT_MAX ? BOTTOM : CONST;   // traps
+        }
+        if (name < 0) return BOTTOM;
+        v = value[name];
+        return state[name];
+    };
+    auto visitPhi = [&](size_t p) {
+        const SsaForm::Phi& phi = ssa.phis[p];
+        Lattice s = TOP;
+        long long v = 0;
+        for (size_t k = 0; k < phi.args.size(); ++k) {
+            if (!edgeLive[ssa.inEdges[phi.block][k]]) continue;
+            int arg = phi.args[k];
+            if (state[arg] == TOP) continue;
+            if (state[arg] == BOTTOM || (s == CONST && value[arg] != v)) {
+                s = BOTTOM;
+                break;
+            }
+            s = CONST;
+            v = value[arg];
+        }
+        if (s != TOP) lower(phi.dst, s, v);
+    };
+    auto visitInstr = [&](size_t i) {
+        const TacInstr& ins = code[i];
+        size_t b = ssa.blockOf[i];
+        long long a = 0, c = 0;
+        if (ins.op == TacOp::ASSIGN) {
+            Lattice s = operandState(ins.a, ssa.useName[i][0], a);
+            if (s != TOP) lower(ssa.defName[i], s, a);
+        } else if (ins.op == TacOp::BINARY) {
+            Lattice sa = operandState(ins.a, ssa.useName[i][0], a);
+            Lattice sb = operandState(ins.b, ssa.useName[i][1], c);
+            long long folded;
+            if (sa == BOTTOM || sb == BOTTOM) lower(ssa.defName[i], BOTTOM, 0);
+            else if (sa == CONST && sb == CONST) {
+                if (foldBinary(ins.binop, a, c, folded)) lower(ssa.defName[i], CONST, folded);
+                else lower(ssa.defName[i], BOTTOM, 0);
+            }
+        }
+        if (i + 1 != ssa.blocks[b].end) return;
+
+        // Block terminator: decide which out-edges can run
+        const vector<size_t>& out = ssa.outEdges[b];
+        if (ins.op == TacOp::IFNOT) {
+            Lattice s = operandState(ins.a, ssa.useName[i][0], a);
+            if (s == TOP) return;
+            if (s == BOTTOM || a == 0) flowWork.push_back(out[0]);
+            if ((s == BOTTOM || a != 0) && out.size() > 1) flowWork.push_back(out[1]);
+        } else if (!out.empty()) {
+            flowWork.push_back(out[0]);
+        }
+    };
+
+    blockLive[0] = true;
+    for (size_t i = ssa.blocks[0].begin; i < ssa.blocks[0].end; ++i) visitInstr(i);
+    while (!flowWork.empty() || !ssaWork.empty()) {
+        while (!flowWork.empty()) {
+            size_t e = flowWork.back();
+            flowWork.pop_back();
+            if (edgeLive[e]) continue;
+            edgeLive[e] = true;
+            size_t b = ssa.edges[e].to;
+            for (size_t p : ssa.blockPhis[b]) visitPhi(p);
+            if (blockLive[b]) continue;
+            blockLive[b] = true;
+            for (size_t i = ssa.blocks[b].begin; i < ssa.blocks[b].end; ++i) visitInstr(i);
+        }
+        while (!ssaWork.empty()) {
+            int name = ssaWork.back();
+            ssaWork.pop_back();
+            for (long long use : users[name]) {
+                if (use < 0) {
+                    if (blockLive[ssa.phis[~use].block]) visitPhi(~use);
+                } else if (blockLive[ssa.blockOf[use]]) {
+                    visitInstr(use);
+                }
+            }
+        }
+    }
+
+    // Rewrite: constant operands and results, folded branches, dead blocks
+    bool changed = false;
+    vector<bool> dead(code.size(), false);
+    for (size_t i = 0; i < code.size(); ++i) {
+        if (!blockLive[ssa.blockOf[i]]) {
+            dead[i] = changed = true;
+            continue;
+        }
+        TacInstr& ins = code[i];
+        for (int k = 0; k < 2; ++k) {
+            int name = ssa.useName[i][k];
+            Operand& op = k == 0 ? ins.a : ins.b;
+            if (name >= 0 && state[name] == CONST) {
+                op = Operand::make(OperandKind::CONST, value[name]);
+                changed = true;
+            }
+        }
+        if (ins.op == TacOp::BINARY && state[ssa.defName[i]] == CONST) {
+            ins.op = TacOp::ASSIGN;
+            ins.a = Operand::make(OperandKind::CONST, value[ssa.defName[i]]);
+            ins.b = Operand();
+            changed = true;
+        }
+        if (ins.op == TacOp::IFNOT && ins.a.isConst() && !ins.hasOutOfRangeConstant()) {
+            if (ins.a.value) dead[i] = true;
+            else ins.op = TacOp::GOTO;
+            ins.a = Operand();
+            changed = true;
+        }
+    }
+    removeMarked(code, dead);
+    return changed;
+}
+
+// Global value numbering over the dominator tree. An operation whose
+// operands have the same value numbers as one in a dominating block
+// becomes a copy, provided some variable (or a temporary of the same
+// block) still holds that value at this point.
+bool globalValueNumbering(TacProgram& tac) {
+    SsaForm ssa = buildSsa(tac);
+    vector<TacInstr>& code = tac.code;
+    if (code.empty()) return false;
+
+    size_t names = ssa.nameStorage.size();
+    vector<int> vn(names, -1);
+    unordered_map<long long, int> constVN;
+    int nextVN = 0;
+    auto constantVN = [&](long long c) {
+        auto it = constVN.find(c);
+        if (it != constVN.end()) return it->second;
+        return constVN[c] = nextVN++;
+    };
+    for (size_t s = 0; s < ssa.storageCount; ++s) vn[s] = constantVN(0);
+    auto operandVN = [&](const Operand& op, int name) {
+        if (op.isConst()) return constantVN(op.value);
+        if (name < 0 || vn[name] < 0) return vn[name] = nextVN++;
+        return vn[name];
+    };
+
+    // Scoped tables; every insertion is logged so leaving a dominator
+    // subtree can undo it
+    unordered_map<uint64_t, int> exprTable;          // (op, vn, vn) -> value number
+    unordered_map<int, vector<int>> holders;         // value number -> names defining it
+    vector<vector<int>> current(ssa.storageCount);
+    struct Undo { int kind; uint64_t key; };
+    vector<Undo> undo;
+    vector<size_t> marks;
+    vector<pair<size_t, bool>> stack = {{0, false}};
+    bool changed = false;
+
+    auto define = [&](int storage, int name) {
+        current[storage].push_back(name);
+        undo.push_back({0, (uint64_t)storage});
+        holders[vn[name]].push_back(name);
+        undo.push_back({1, (uint64_t)vn[name]});
+    };
+
+    while (!ssa.blocks.empty() && !stack.empty()) {
+        auto [b, exiting] = stack.back();
+        stack.pop_back();
+        if (exiting) {
+            size_t mark = marks.back();
+            marks.pop_back();
+            while (undo.size() > mark) {
+                Undo u = undo.back();
+                undo.pop_back();
+                if (u.kind == 0) current[u.key].pop_back();
+                else if (u.kind == 1) holders[u.key].pop_back();
+                else exprTable.erase(u.key);
+            }
+            continue;
+        }
+        marks.push_back(undo.size());
+        stack.push_back({b, true});
+
+        for (size_t p : ssa.blockPhis[b]) {
+            const SsaForm::Phi& phi = ssa.phis[p];
+            // A phi whose live inputs all agree is just that value
+            int same = -1;
+            bool agree = true;
+            for (size_t k = 0; k < phi.args.size() && agree; ++k) {
+                if (!ssa.reachable(ssa.edges[ssa.inEdges[b][k]].from)) continue;
+                int argVN = vn[phi.args[k]];
+                if (argVN < 0 || (same >= 0 && argVN != same)) agree = false;
+                same = argVN;
+            }
+            vn[phi.dst] = agree && same >= 0 ? same : nextVN++;
+            define(phi.storage, phi.dst);
+        }
+        for (size_t i = ssa.blocks[b].begin; i < ssa.blocks[b].end; ++i) {
+            TacInstr& ins = code[i];
+            if (!ins.definesValue()) continue;
+            int dst = ssa.defName[i];
+            if (ins.op == TacOp::ASSIGN) {
+                vn[dst] = operandVN(ins.a, ssa.useName[i][0]);
+            } else {
+                uint64_t left = operandVN(ins.a, ssa.useName[i][0]);
+                uint64_t right = operandVN(ins.b, ssa.useName[i][1]);
+                bool commutative = ins.binop == BinOp::ADD || ins.binop == BinOp::MUL ||
+                                   ins.binop == BinOp::EQ || ins.binop == BinOp::NE;
+                if (commutative && right < left) swap(left, right);
+                uint64_t key = (uint64_t)ins.binop << 56 | left << 28 | right;
+                auto it = exprTable.find(key);
+                if (it == exprTable.end()) {
+                    vn[dst] = nextVN++;
+                    exprTable[key] = vn[dst];
+                    undo.push_back({2, key});
+                } else {
+                    vn[dst] = it->second;
+                    const vector<int>& held = holders[vn[dst]];
+                    for (size_t k = held.size(); k-- > 0; ) {
+                        int h = held[k];
+                        int s = ssa.nameStorage[h];
+                        bool visible = (size_t)s < ssa.symbolCount || ssa.nameBlock[h] == (int)b;
+                        if (visible && !current[s].empty() && current[s].back() == h) {
+                            ins.op = TacOp::ASSIGN;
+                            ins.a = ssa.operandOf(s);
+                            ins.b = Operand();
+                            changed = true;
+                            break;
+                        }
+                    }
+                }
+            }
+            define(ssa.storageOf(ins.dst), dst);
+        }
+        // Children in block order, so both arms of an agar are numbered
+        // before the join that merges them
+        const vector<size_t>& children = ssa.domChildren[b];
+        for (size_t k = children.size(); k-- > 0; ) stack.push_back({children[k], false});
+    }
+    return changed;
+}
+
+struct PassStats {
+    const char* name;
+    size_t before, after;
+    double millis;
+};
+
+// Runs TAC passes in order and records their effect and cost
+class TacPassManager {
+    vector<pair<const char*, bool (*)(TacProgram&)>> passes;
+public:
+    void add(const char* name, bool (*pass)(TacProgram&)) { passes.push_back({name, pass}); }
+
+    // The standard pipeline: local passes first, then the SSA-based
+    // global ones; copy propagation runs again to clean up the copies
+    // value numbering leaves behind
+    static TacPassManager standard() {
+        TacPassManager pm;
+        pm.add("constant-folding", constantFolding);
+        pm.add("copy-propagation", copyPropagation);
+        pm.add("local-cse", localValueNumbering);
+        pm.add("copy-propagation", copyPropagation);
+        pm.add("sccp", sparseConditionalConstants);
+        pm.add("global-value-numbering", globalValueNumbering);
+        pm.add("copy-propagation", copyPropagation);
+        pm.add("dead-code-elimination", deadCodeElimination);
+        return pm;
+    }
+
+    vector<PassStats> run(TacProgram& tac) const {
+        vector<PassStats> stats;
+        for (const auto& pass : passes) {
+            auto start = chrono::steady_clock::now();
+            size_t before = tac.code.size();
+            pass.second(tac);
+            chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+            stats.push_back({pass.first, before, tac.code.size(), elapsed.count()});
+        }
+        return stats;
+    }
+};
+
+// --- x86-64 code generation ---
+// The optimized TAC is lowered to a structured x86-64 listing. Variables
+// and temporaries get registers from a linear-scan allocator and spill
+// to stack slots when it runs out; print and return call small runtime
+// helpers. The program is one function returning 0, or 1 after a trap.
+
+// General-purpose registers in hardware encoding order
+enum class Reg : uint8_t { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+const char* regName(Reg r, int bits) {
+    static const char* const names64[] = {"rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+                                          "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15"};
+    static const char* const names32[] = {"eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi",
+                                          "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d"};
+    static const char* const names8[] = {"al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil",
+                                         "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b"};
+    return bits == 64 ? names64[(int)r] : bits == 8 ? names8[(int)r] : names32[(int)r];
+}
+
+// Condition codes for signed comparisons
+enum class Cond : uint8_t { E, NE, L, LE, G, GE };
+
+const char* condName(Cond c) {
+    static const char* const names[] = {"e", "ne", "l", "le", "g", "ge"};
+    return names[(int)c];
+}
+
+Cond negateCond(Cond c) {
+    static const Cond negated[] = {Cond::NE, Cond::E, Cond::GE, Cond::G, Cond::LE, Cond::L};
+    return negated[(int)c];
+}
+
+// The condition that holds after swapping the operands of a cmp
+Cond swapCond(Cond c) {
+    static const Cond swapped[] = {Cond::E, Cond::NE, Cond::G, Cond::GE, Cond::L, Cond::LE};
+    return swapped[(int)c];
+}
+
+// Runtime functions the generated code calls. The int helpers take their
+// value in edi; mukku_print_str and mukku_trap take a data string in rdi.
+enum class RuntimeHelper : uint8_t { PRINT_INT, PRINT_STR, RETURN, TRAP };
+
+const char* helperName(RuntimeHelper h) {
+    static const char* const names[] = {"mukku_print_int", "mukku_print_str", "mukku_return", "mukku_trap"};
+    return names[(int)h];
+}
+
+enum class MOp : uint8_t {
+    MOV, ADD, SUB, IMUL, AND, XOR, SHL, SAR, CMP, TEST, SETCC, MOVZX, CDQ, IDIV,
+    JMP, JCC, LABEL, CALL, PUSH, POP, RET, LEA
+};
+
+enum class MKind : uint8_t { NONE, REG, IMM, SLOT, LABEL, HELPER, DATA };
+
+// A register, immediate, stack slot (bytes below rbp), label, helper or
+// rip-relative data string
+struct MOperand {
+    MKind kind = MKind::NONE;
+    long long value = 0;
+
+    static MOperand make(MKind k, long long v) {
+        MOperand op;
+        op.kind = k;
+        op.value = v;
+        return op;
+    }
+    static MOperand reg(Reg r) { return make(MKind::REG, (int)r); }
+    static MOperand imm(long long v) { return make(MKind::IMM, v); }
+
+    bool isReg() const { return kind == MKind::REG; }
+    bool isImm() const { return kind == MKind::IMM; }
+    bool isMem() const { return kind == MKind::SLOT; }
+    Reg asReg() const { return (Reg)value; }
+    bool operator==(const MOperand& o) const { return kind == o.kind && value == o.value; }
+    bool operator!=(const MOperand& o) const { return !(*this == o); }
+};
+
+// One instruction in Intel operand order. 'bits' is the operand size;
+// setcc and the source of movzx are byte registers. 'extra' is the
+// immediate of the three-operand imul.
+struct MInstr {
+    MOp op;
+    Cond cc = Cond::E;
+    uint8_t bits = 32;
+    MOperand dst, src, extra;
+};
+
+struct MachineCode {
+    vector<MInstr> code;
+    vector<string> data;               // string literals, then trap messages
+    size_t spillSlots = 0;
+
+    static string operandText(const MOperand& op, int bits) {
+        switch (op.kind) {
+            case MKind::REG: return regName(op.asReg(), bits);
+            case MKind::IMM: return to_string(op.value);
+            case MKind::SLOT: return string(bits == 64 ? "qword" : "dword") + " ptr [rbp - " + to_string(op.value) + "]";
+            case MKind::LABEL: return "L" + to_string(op.value);
+            case MKind::HELPER: return helperName((RuntimeHelper)op.value);
+            case MKind::DATA: return "[rip + S" + to_string(op.value) + "]";
+            case MKind::NONE: break;
+        }
+        return "";
+    }
+
+    string format(const MInstr& ins) const {
+        static const char* const names[] = {"mov", "add", "sub", "imul", "and", "xor", "shl", "sar", "cmp",
+                                            "test", "set", "movzx", "cdq", "idiv", "jmp", "j", "", "call",
+                                            "push", "pop", "ret", "lea"};
+        string text = names[(int)ins.op];
+        switch (ins.op) {
+            case MOp::LABEL: return operandText(ins.dst, 32) + ":";
+            case MOp::SETCC: return text + condName(ins.cc) + " " + operandText(ins.dst, 8);
+            case MOp::JCC: return text + condName(ins.cc) + " " + operandText(ins.dst, 32);
+            case MOp::MOVZX: return text + " " + operandText(ins.dst, 32) + ", " + operandText(ins.src, 8);
+            case MOp::CDQ: case MOp::RET: return text;
+            default: break;
+        }
+        text += " " + operandText(ins.dst, ins.bits);
+        if (ins.src.kind != MKind::NONE) text += ", " + operandText(ins.src, ins.bits);
+        if (ins.extra.kind != MKind::NONE) text += ", " + operandText(ins.extra, ins.bits);
+        return text;
+    }
+
+    string formatData(size_t index) const {
+        string text = "S" + to_string(index) + ": db \"";
+        for (char c : data[index]) {
+            if (c == '"' || c == '\\') text += '\\';
+            text += c;
+        }
+        return text + "\", 0";
+    }
+};
+
+// Lowers optimized TAC to MachineCode: live intervals from block
+// liveness, linear-scan allocation over the x86-64 registers, then
+// instruction selection against the chosen locations.
+class X86CodeGenerator {
+    // rax and rdx belong to idiv and r11 is a scratch register, so none
+    // of them is ever allocated. Intervals live across a call prefer the
+    // callee-saved registers; caller-saved ones are preserved around it.
+    static constexpr Reg calleeSaved[] = {Reg::RBX, Reg::R12, Reg::R13, Reg::R14, Reg::R15};
+    static constexpr Reg callerSaved[] = {Reg::RCX, Reg::RSI, Reg::RDI, Reg::R8, Reg::R9, Reg::R10};
+
+    struct LiveInterval {
+        int storage;
+        int start, end;          // positions: 2i reads instruction i, 2i + 1 writes it
+        bool crossesCall;
+    };
+
+    const TacProgram& tac;
+    MachineCode& mc;
+    size_t symbolCount;
+    vector<MOperand> location;                 // storage -> register or slot
+    vector<int> intervalEnd;                   // storage -> last position
+    vector<int> zeroInit;                      // variables read before any write
+    vector<bool> calleeUsed = vector<bool>(16, false);
+    vector<int> saveSlot = vector<int>(16, -1);
+    vector<LiveInterval> crossingCallerSaved;  // saved around the calls they span
+    vector<MInstr> body;
+    int pushed = 0;                            // callee-saved registers pushed
+    int nextLabel;
+    int exitLabel;
+    map<string, pair<int, size_t>> trapLabels;  // message -> stub label, data index
+
+    static bool isCalleeSaved(Reg r) { return find(begin(calleeSaved), end(calleeSaved), r) != end(calleeSaved); }
+
+    int storageOf(const Operand& op) const {
+        if (op.kind == OperandKind::VAR) return op.value;
+        if (op.kind == OperandKind::TEMP) return symbolCount + op.value;
+        return -1;
+    }
+
+    MOperand slot(size_t index) const { return MOperand::make(MKind::SLOT, 8 * pushed + 4 * (index + 1)); }
+
+    MOperand loc(const Operand& op) const {
+        if (op.isConst()) return MOperand::imm(op.value);
+        return location[storageOf(op)];
+    }
+
+    void emit(MOp op, MOperand dst = MOperand(), MOperand src = MOperand(), uint8_t bits = 32) {
+        MInstr ins;
+        ins.op = op;
+        ins.dst = dst;
+        ins.src = src;
+        ins.bits = bits;
+        body.push_back(ins);
+    }
+
+    void emitCond(MOp op, Cond cc, MOperand dst) {
+        emit(op, dst, MOperand(), op == MOp::SETCC ? 8 : 32);
+        body.back().cc = cc;
+    }
+
+    void emitMove(MOperand dst, MOperand src) {
+        if (dst == src) return;
+        if (dst.isMem() && src.isMem()) {
+            emit(MOp::MOV, MOperand::reg(Reg::RAX), src);
+            src = MOperand::reg(Reg::RAX);
+        }
+        emit(MOp::MOV, dst, src);
+    }
+
+    int trapLabel(const string& message) {
+        auto it = trapLabels.find(message);
+        if (it != trapLabels.end()) return it->second.first;
+        mc.data.push_back(message);
+        trapLabels[message] = {nextLabel, mc.data.size() - 1};
+        return nextLabel++;
+    }
+
+    void allocateRegisters();
+    bool lowerBinary(size_t i);
+    void lowerDivision(const TacInstr& ins);
+    void lowerCall(RuntimeHelper helper, MOperand arg, size_t i);
+public:
+    X86CodeGenerator(const TacProgram& program, MachineCode& out)
+        : tac(program), mc(out), symbolCount(program.symbols->size()),
+          nextLabel(program.counter + 1), exitLabel(program.counter + 1) {
+        ++nextLabel;
+    }
+
+    void generate();
+};
+
+constexpr Reg X86CodeGenerator::calleeSaved[];
+constexpr Reg X86CodeGenerator::callerSaved[];
+
+void X86CodeGenerator::allocateRegisters() {
+    const vector<TacInstr>& code = tac.code;
+    size_t storageCount = symbolCount + tac.counter + 1;
+    vector<int> start(storageCount, INT_MAX), last(storageCount, -1);
+    auto touch = [&](int s, int pos) {
+        start[s] = min(start[s], pos);
+        last[s] = max(last[s], pos);
+    };
+    vector<int> callsBefore(code.size() + 1, 0);
+    for (size_t i = 0; i < code.size(); ++i) {
+        code[i].forEachUse([&](const Operand& use) {
+            if (use.isStorage()) touch(storageOf(use), 2 * i);
+        });
+        if (code[i].definesValue()) touch(storageOf(code[i].dst), 2 * i + 1);
+        bool call = code[i].op == TacOp::PRINT || code[i].op == TacOp::RETURN;
+        callsBefore[i + 1] = callsBefore[i] + call;
+    }
+
+    // Jumps only go forward, so one interval from the first to the last
+    // position a value is live covers every path through the program
+    vector<BasicBlock> blocks = splitBasicBlocks(code);
+    VarLiveness liveness = computeVarLiveness(code, blocks, symbolCount);
+    auto forEachBit = [](const vector<uint64_t>& set, auto f) {
+        for (size_t w = 0; w < set.size(); ++w) {
+            for (uint64_t bits = set[w]; bits; bits &= bits - 1) f(w * 64 + __builtin_ctzll(bits));
+        }
+    };
+    for (size_t b = 0; b < blocks.size(); ++b) {
+        forEachBit(liveness.liveIn[b], [&](int v) { touch(v, 2 * blocks[b].begin); });
+        forEachBit(liveness.liveOut[b], [&](int v) { touch(v, 2 * blocks[b].end - 1); });
+    }
+    if (!blocks.empty()) {
+        forEachBit(liveness.liveIn[0], [&](int v) {
+            zeroInit.push_back(v);
+            start[v] = -1;
+        });
+    }
+
+    vector<LiveInterval> intervals;
+    for (size_t s = 0; s < storageCount; ++s) {
+        if (last[s] < 0) continue;
+        // A call at instruction j clobbers values live across position 2j
+        int from = start[s] < 0 ? 0 : start[s] / 2 + 1;
+        int to = (last[s] + 1) / 2;
+        bool crosses = to > from && callsBefore[to] - callsBefore[from] > 0;
+        intervals.push_back({(int)s, start[s], last[s], crosses});
+    }
+    sort(intervals.begin(), intervals.end(), [](const LiveInterval& x, const LiveInterval& y) {
+        return x.start < y.start;
+    });
+
+    location.assign(storageCount, MOperand());
+    intervalEnd = last;
+    vector<Reg> freeCallee(rbegin(calleeSaved), rend(calleeSaved));
+    vector<Reg> freeCaller(rbegin(callerSaved), rend(callerSaved));
+    vector<const LiveInterval*> active;        // sorted by end
+    vector<int> spilled;
+    auto release = [&](Reg r) { (isCalleeSaved(r) ? freeCallee : freeCaller).push_back(r); };
+    auto activate = [&](const LiveInterval* interval) {
+        auto pos = upper_bound(active.begin(), active.end(), interval, [](const LiveInterval* x, const LiveInterval* y) {
+            return x->end < y->end;
+        });
+        active.insert(pos, interval);
+    };
+
+    for (const LiveInterval& current : intervals) {
+        while (!active.empty() && active.front()->end < current.start) {
+            release(location[active.front()->storage].asReg());
+            active.erase(active.begin());
+        }
+        vector<Reg>& first = current.crossesCall ? freeCallee : freeCaller;
+        vector<Reg>& second = current.crossesCall ? freeCaller : freeCallee;
+        vector<Reg>& pool = !first.empty() ? first : second;
+        if (!pool.empty()) {
+            location[current.storage] = MOperand::reg(pool.back());
+            pool.pop_back();
+            activate(&current);
+            continue;
+        }
+        // Out of registers: spill whichever interval ends last
+        const LiveInterval* victim = active.back();
+        if (victim->end > current.end) {
+            location[current.storage] = location[victim->storage];
+            spilled.push_back(victim->storage);
+            active.pop_back();
+            activate(&current);
+        } else {
+            spilled.push_back(current.storage);
+        }
+    }
+    for (int s : spilled) location[s] = MOperand();
+    for (const LiveInterval& interval : intervals) {
+        const MOperand& where = location[interval.storage];
+        if (!where.isReg()) continue;
+        if (isCalleeSaved(where.asReg())) calleeUsed[where.value] = true;
+        else if (interval.crossesCall) crossingCallerSaved.push_back(interval);
+    }
+    for (bool used : calleeUsed) pushed += used;
+    for (int s : spilled) location[s] = slot(mc.spillSlots++);
+}
+
+// Returns true if the instruction was fused with the ifnot after it
+bool X86CodeGenerator::lowerBinary(size_t i) {
+    const TacInstr& ins = tac.code[i];
+    if (ins.binop == BinOp::DIV) {
+        lowerDivision(ins);
+        return false;
+    }
+    MOperand d = loc(ins.dst), a = loc(ins.a), b = loc(ins.b);
+    const MOperand rax = MOperand::reg(Reg::RAX);
+
+    if (ins.binop != BinOp::ADD && ins.binop != BinOp::SUB && ins.binop != BinOp::MUL) {
+        static const Cond conds[] = {Cond::E, Cond::E, Cond::E, Cond::E, Cond::E, Cond::NE,
+                                     Cond::L, Cond::LE, Cond::G, Cond::GE};
+        Cond cc = conds[(int)ins.binop];
+        if (a.isImm() && !b.isImm()) {
+            swap(a, b);
+            cc = swapCond(cc);
+        }
+        if (a.isImm() || (a.isMem() && b.isMem())) {
+            emitMove(rax, a);
+            a = rax;
+        }
+        emit(MOp::CMP, a, b);
+        // A comparison feeding only the next branch becomes cmp + jcc
+        const TacInstr* next = i + 1 < tac.code.size() ? &tac.code[i + 1] : nullptr;
+        if (next && next->op == TacOp::IFNOT && next->a == ins.dst && ins.dst.kind == OperandKind::TEMP &&
+            intervalEnd[storageOf(ins.dst)] == (int)(2 * i + 2)) {
+            emitCond(MOp::JCC, negateCond(cc), MOperand::make(MKind::LABEL, next->label));
+            return true;
+        }
+        MOperand w = d.isReg() ? d : rax;
+        emitCond(MOp::SETCC, cc, w);
+        emit(MOp::MOVZX, w, w);
+        emitMove(d, w);
+        return false;
+    }
+
+    MOp op = ins.binop == BinOp::ADD ? MOp::ADD : ins.binop == BinOp::SUB ? MOp::SUB : MOp::IMUL;
+    if (op != MOp::SUB && (b == d || a.isImm())) swap(a, b);
+    // Writing d early would clobber b, so such results go through rax
+    MOperand w = d.isReg() && b != d ? d : rax;
+    if (op == MOp::IMUL && b.isImm()) {
+        if (a.isImm()) {
+            emitMove(w, a);
+            a = w;
+        }
+        emit(MOp::IMUL, w, a);
+        body.back().extra = b;
+    } else {
+        emitMove(w, a);
+        emit(op, w, b);
+    }
+    emitMove(d, w);
+    return false;
+}
+
+// idiv takes the dividend in edx:eax. Division by zero and INT_MIN / -1
+// are checked first and reported like the VM does instead of faulting.
+void X86CodeGenerator::lowerDivision(const TacInstr& ins) {
+    MOperand d = loc(ins.dst), a = loc(ins.a), b = loc(ins.b);
+    const MOperand rax = MOperand::reg(Reg::RAX);
+    // Stubs are only requested by a check that jumps to them
+    auto divZero = [this] { return MOperand::make(MKind::LABEL, trapLabel("division by zero")); };
+    auto overflow = [this] { return MOperand::make(MKind::LABEL, trapLabel("integer overflow in division")); };
+
+    if (b.isImm()) {
+        if (b.value == 0) {
+            emit(MOp::JMP, divZero());
+            return;
+        }
+        emitMove(rax, a);
+        if (b.value == -1) {
+            emit(MOp::CMP, rax, MOperand::imm(INT_MIN));
+            emitCond(MOp::JCC, Cond::E, overflow());
+        }
+        emit(MOp::MOV, MOperand::reg(Reg::R11), b);
+        b = MOperand::reg(Reg::R11);
+    } else {
+        if (b.isReg()) emit(MOp::TEST, b, b);
+        else emit(MOp::CMP, b, MOperand::imm(0));
+        emitCond(MOp::JCC, Cond::E, divZero());
+        emitMove(rax, a);
+        MOperand ok = MOperand::make(MKind::LABEL, nextLabel++);
+        emit(MOp::CMP, b, MOperand::imm(-1));
+        emitCond(MOp::JCC, Cond::NE, ok);
+        emit(MOp::CMP, rax, MOperand::imm(INT_MIN));
+        emitCond(MOp::JCC, Cond::E, overflow());
+        emit(MOp::LABEL, ok);
+    }
+    emit(MOp::CDQ);
+    emit(MOp::IDIV, b);
+    emitMove(d, rax);
+}
+
+// Caller-saved registers still needed after the call are kept in
+// their own stack slots across it
+void X86CodeGenerator::lowerCall(RuntimeHelper helper, MOperand arg, size_t i) {
+    vector<Reg> saved;
+    for (const LiveInterval& interval : crossingCallerSaved) {
+        if (interval.start < (int)(2 * i) && interval.end > (int)(2 * i)) {
+            saved.push_back(location[interval.storage].asReg());
+        }
+    }
+    for (Reg r : saved) {
+        if (saveSlot[(int)r] < 0) saveSlot[(int)r] = mc.spillSlots++;
+        emit(MOp::MOV, slot(saveSlot[(int)r]), MOperand::reg(r));
+    }
+    if (arg.kind == MKind::DATA) emit(MOp::LEA, MOperand::reg(Reg::RDI), arg, 64);
+    else emitMove(MOperand::reg(Reg::RDI), arg);
+    emit(MOp::CALL, MOperand::make(MKind::HELPER, (int)helper));
+    for (Reg r : saved) emit(MOp::MOV, MOperand::reg(r), slot(saveSlot[(int)r]));
+}
+
+void X86CodeGenerator::generate() {
+    allocateRegisters();
+    for (string_view literal : tac.strings) mc.data.emplace_back(literal.substr(1, literal.size() - 2));
+    for (int v : zeroInit) {
+        MOperand where = location[v];
+        if (where.isReg()) emit(MOp::XOR, where, where);
+        else emit(MOp::MOV, where, MOperand::imm(0));
+    }
+
+    const vector<TacInstr>& code = tac.code;
+    for (size_t i = 0; i < code.size(); ++i) {
+        const TacInstr& ins = code[i];
+        if (ins.hasOutOfRangeConstant()) {
+            long long literal = 0;
+            ins.forEachUse([&](const Operand& use) {
+                if (use.isConst() && (use.value < INT_MIN || use.value > INT_MAX) && !literal) literal = use.value;
+            });
+            auto text = tac.literalText.find(literal);
+            string written = text != tac.literalText.end() ? string(text->second) : to_string(literal);
+            string message = "integer literal '" + written + "' is out of range";
+            emit(MOp::JMP, MOperand::make(MKind::LABEL, trapLabel(message)));
+            continue;
+        }
+        switch (ins.op) {
+            case TacOp::ASSIGN: emitMove(loc(ins.dst), loc(ins.a)); break;
+            case TacOp::BINARY:
+                if (lowerBinary(i)) ++i;
+                break;
+            case TacOp::IFNOT: {
+                MOperand target = MOperand::make(MKind::LABEL, ins.label);
+                MOperand cond = loc(ins.a);
+                if (cond.isImm()) {
+                    if (cond.value == 0) emit(MOp::JMP, target);
+                    break;
+                }
+                if (cond.isReg()) emit(MOp::TEST, cond, cond);
+                else emit(MOp::CMP, cond, MOperand::imm(0));
+                emitCond(MOp::JCC, Cond::E, target);
+                break;
+            }
+            case TacOp::GOTO: emit(MOp::JMP, MOperand::make(MKind::LABEL, ins.label)); break;
+            case TacOp::LABEL: emit(MOp::LABEL, MOperand::make(MKind::LABEL, ins.label)); break;
+            case TacOp::PRINT:
+                if (ins.a.kind == OperandKind::STRING) lowerCall(RuntimeHelper::PRINT_STR, MOperand::make(MKind::DATA, ins.a.value), i);
+                else lowerCall(RuntimeHelper::PRINT_INT, loc(ins.a), i);
+                break;
+            case TacOp::RETURN: lowerCall(RuntimeHelper::RETURN, loc(ins.a), i); break;
+        }
+    }
+
+    // Frame: rbp, callee-saved registers, then 4-byte slots, keeping rsp
+    // 16-byte aligned at every call
+    const MOperand rsp = MOperand::reg(Reg::RSP), rbp = MOperand::reg(Reg::RBP);
+    long long frame = (8 * pushed + 4 * (long long)mc.spillSlots + 15) / 16 * 16 - 8 * pushed;
+    auto add = [&](MOp op, MOperand dst = MOperand(), MOperand src = MOperand(), uint8_t bits = 64) {
+        MInstr ins;
+        ins.op = op;
+        ins.dst = dst;
+        ins.src = src;
+        ins.bits = bits;
+        mc.code.push_back(ins);
+    };
+    add(MOp::PUSH, rbp);
+    add(MOp::MOV, rbp, rsp);
+    for (int r = 0; r < 16; ++r) {
+        if (calleeUsed[r]) add(MOp::PUSH, MOperand::reg((Reg)r));
+    }
+    if (frame) add(MOp::SUB, rsp, MOperand::imm(frame));
+    mc.code.insert(mc.code.end(), body.begin(), body.end());
+
+    const MOperand rax = MOperand::reg(Reg::RAX), exit = MOperand::make(MKind::LABEL, exitLabel);
+    add(MOp::XOR, rax, rax, 32);
+    add(MOp::LABEL, exit);
+    if (frame) add(MOp::ADD, rsp, MOperand::imm(frame));
+    for (int r = 15; r >= 0; --r) {
+        if (calleeUsed[r]) add(MOp::POP, MOperand::reg((Reg)r));
+    }
+    add(MOp::POP, rbp);
+    add(MOp::RET);
+
+    // One stub per trap message, in the order they were first needed
+    vector<pair<int, size_t>> stubs;
+    for (const auto& trap : trapLabels) stubs.push_back(trap.second);
+    sort(stubs.begin(), stubs.end());
+    for (const auto& stub : stubs) {
+        add(MOp::LABEL, MOperand::make(MKind::LABEL, stub.first));
+        add(MOp::LEA, MOperand::reg(Reg::RDI), MOperand::make(MKind::DATA, stub.second), 64);
+        add(MOp::CALL, MOperand::make(MKind::HELPER, (int)RuntimeHelper::TRAP));
+        add(MOp::MOV, rax, MOperand::imm(1), 32);
+        add(MOp::JMP, exit);
+    }
+}
+
+// --- Peephole optimization ---
+// Small rewrites over the generated listing, each looking at a few
+// neighbouring instructions. None of them moves code across a label, a
+// jump or a call, except that calls only clobber the caller-saved
+// registers. The listing is the single function 'main'.
+
+struct PeepholeStats {
+    const char* function;
+    size_t before, after;
+    size_t removed = 0;
+    size_t added = 0;             // by rewrites that expand, such as constant division
+};
+
+// Registers an instruction reads and writes, as masks of 1 << Reg
+struct RegEffects {
+    uint32_t reads = 0, writes = 0;
+};
+
+static uint32_t regBit(const MOperand& op) { return op.isReg() ? 1u << op.value : 0; }
+static uint32_t regBit(Reg r) { return 1u << (int)r; }
+
+static const uint32_t CALL_CLOBBERED = regBit(Reg::RAX) | regBit(Reg::RCX) | regBit(Reg::RDX) | regBit(Reg::RSI) |
+                                       regBit(Reg::RDI) | regBit(Reg::R8) | regBit(Reg::R9) | regBit(Reg::R10) |
+                                       regBit(Reg::R11);
+
+// True if the instruction stores into its destination operand
+static bool writesDst(MOp op) {
+    switch (op) {
+        case MOp::MOV: case MOp::ADD: case MOp::SUB: case MOp::IMUL: case MOp::AND: case MOp::XOR:
+        case MOp::SHL: case MOp::SAR: case MOp::SETCC: case MOp::MOVZX: case MOp::POP: case MOp::LEA:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// setcc writes only the low byte, so it also reads its register
+static RegEffects regEffects(const MInstr& ins) {
+    RegEffects e;
+    switch (ins.op) {
+        case MOp::MOV: case MOp::MOVZX: case MOp::LEA:
+            e.reads = regBit(ins.src);
+            e.writes = regBit(ins.dst);
+            break;
+        case MOp::XOR:
+            if (ins.dst == ins.src) {
+                e.writes = regBit(ins.dst);
+                break;
+            }
+            e.reads = regBit(ins.dst) | regBit(ins.src);
+            e.writes = regBit(ins.dst);
+            break;
+        case MOp::IMUL:
+            e.reads = regBit(ins.src) | (ins.extra.isImm() ? 0 : regBit(ins.dst));
+            e.writes = regBit(ins.dst);
+            break;
+        case MOp::ADD: case MOp::SUB: case MOp::AND: case MOp::SHL: case MOp::SAR: case MOp::SETCC:
+            e.reads = regBit(ins.dst) | regBit(ins.src);
+            e.writes = regBit(ins.dst);
+            break;
+        case MOp::CMP: case MOp::TEST: case MOp::PUSH:
+            e.reads = regBit(ins.dst) | regBit(ins.src);
+            break;
+        case MOp::POP: e.writes = regBit(ins.dst); break;
+        case MOp::CDQ:
+            e.reads = regBit(Reg::RAX);
+            e.writes = regBit(Reg::RDX);
+            break;
+        case MOp::IDIV:
+            e.reads = regBit(Reg::RAX) | regBit(Reg::RDX) | regBit(ins.dst);
+            e.writes = regBit(Reg::RAX) | regBit(Reg::RDX);
+            break;
+        case MOp::CALL:
+            e.reads = regBit(Reg::RDI);
+            e.writes = CALL_CLOBBERED;
+            break;
+        case MOp::JMP: case MOp::JCC: case MOp::LABEL: case MOp::RET:
+            break;
+    }
+    return e;
+}
+
+static bool endsStraightLine(MOp op) {
+    return op == MOp::LABEL || op == MOp::JMP || op == MOp::JCC || op == MOp::RET;
+}
+
+// True if register 'r' is overwritten before anything reads it after
+// instruction 'i'. Only a short straight-line window is examined; a
+// value that may still be live past it counts as live.
+static bool deadAfter(const vector<MInstr>& code, size_t i, Reg r) {
+    const uint32_t bit = regBit(r);
+    for (size_t j = i + 1; j < code.size() && j <= i + 16; ++j) {
+        if (endsStraightLine(code[j].op)) return false;
+        RegEffects e = regEffects(code[j]);
+        if (e.reads & bit) return false;
+        if (e.writes & bit) return true;
+    }
+    return false;
+}
+
+static bool isPowerOfTwo(long long v) { return v > 0 && (v & (v - 1)) == 0; }
+
+// mov r, imm; op x, r  =>  op x, imm  when r is dead afterwards
+static void foldImmediates(vector<MInstr>& code) {
+    auto foldable = [&](size_t i) {
+        const MInstr& load = code[i];
+        if (load.op != MOp::MOV || !load.dst.isReg() || !load.src.isImm() || load.bits != 32) return false;
+        if (i + 1 == code.size()) return false;
+        const MInstr& use = code[i + 1];
+        if (use.src != load.dst || use.dst == load.dst || use.bits != 32 || use.extra.kind != MKind::NONE) return false;
+        if (use.op != MOp::ADD && use.op != MOp::SUB && use.op != MOp::CMP && use.op != MOp::IMUL) return false;
+        return deadAfter(code, i + 1, load.dst.asReg());
+    };
+    size_t kept = 0;
+    for (size_t i = 0; i < code.size(); ++i) {
+        if (!foldable(i)) {
+            code[kept++] = code[i];
+            continue;
+        }
+        MInstr& use = code[i + 1];
+        if (use.op == MOp::IMUL) {
+            use.src = use.dst;              // three-operand form: dst = dst * imm
+            use.extra = code[i].src;
+        } else {
+            use.src = code[i].src;
+        }
+    }
+    code.resize(kept);
+}
+
+// Multiplies and divides by a power of two become shifts. Signed
+// division truncates towards zero, so a negative dividend is first
+// biased by divisor - 1, which cdq and a mask produce without a branch.
+// Returns how many instructions the rewrites added beyond those they
+// replaced.
+static size_t reduceStrength(vector<MInstr>& code) {
+    vector<MInstr> out;
+    out.reserve(code.size());
+    auto make = [](MOp op, MOperand dst, MOperand src = MOperand()) {
+        MInstr ins;
+        ins.op = op;
+        ins.dst = dst;
+        ins.src = src;
+        return ins;
+    };
+    const MOperand rax = MOperand::reg(Reg::RAX), rdx = MOperand::reg(Reg::RDX);
+    size_t added = 0;
+    auto replaced = [&](size_t count, size_t mark) {
+        if (out.size() - mark > count) added += out.size() - mark - count;
+    };
+    for (size_t i = 0; i < code.size(); ++i) {
+        const MInstr& ins = code[i];
+        size_t mark = out.size();
+        if (ins.op == MOp::IMUL && ins.extra.isImm() && isPowerOfTwo(ins.extra.value) && ins.bits == 32) {
+            int shift = __builtin_ctzll(ins.extra.value);
+            if (ins.src != ins.dst) out.push_back(make(MOp::MOV, ins.dst, ins.src));
+            if (shift) out.push_back(make(MOp::SHL, ins.dst, MOperand::imm(shift)));
+            replaced(1, mark);
+            continue;
+        }
+        // The generator divides by a constant as mov r11, imm; cdq; idiv r11
+        bool constantDivisor = ins.op == MOp::MOV && ins.dst == MOperand::reg(Reg::R11) && ins.src.isImm();
+        if (constantDivisor && isPowerOfTwo(ins.src.value) && i + 2 < code.size() && code[i + 1].op == MOp::CDQ &&
+            code[i + 2].op == MOp::IDIV && code[i + 2].dst == ins.dst) {
+            int shift = __builtin_ctzll(ins.src.value);
+            if (shift) {
+                out.push_back(make(MOp::CDQ, MOperand()));
+                out.push_back(make(MOp::AND, rdx, MOperand::imm(ins.src.value - 1)));
+                out.push_back(make(MOp::ADD, rax, rdx));
+                out.push_back(make(MOp::SAR, rax, MOperand::imm(shift)));
+            }
+            replaced(3, mark);
+            i += 2;
+            continue;
+        }
+        out.push_back(ins);
+    }
+    code.swap(out);
+    return added;
+}
+
+// A reload of a stack slot whose value is still in a register becomes a
+// register move, or nothing when it is the same register
+static void forwardStores(vector<MInstr>& code) {
+    unordered_map<long long, Reg> holder;      // slot -> register with its value
+    vector<long long> held[16];                // register -> slots it may hold
+    auto hold = [&](long long slot, Reg r) {
+        holder[slot] = r;
+        held[(int)r].push_back(slot);
+    };
+    auto forget = [&](uint32_t regs) {
+        for (; regs; regs &= regs - 1) {
+            int r = __builtin_ctz(regs);
+            for (long long slot : held[r]) {
+                auto it = holder.find(slot);
+                if (it != holder.end() && (int)it->second == r) holder.erase(it);
+            }
+            held[r].clear();
+        }
+    };
+    size_t kept = 0;
+    for (size_t i = 0; i < code.size(); ++i) {
+        MInstr ins = code[i];
+        if (ins.op == MOp::LABEL) {
+            holder.clear();
+            for (vector<long long>& slots : held) slots.clear();
+        } else if (ins.op == MOp::MOV && ins.bits == 32 && ins.dst.isReg() && ins.src.isMem()) {
+            long long slot = ins.src.value;
+            auto it = holder.find(slot);
+            if (it != holder.end() && it->second == ins.dst.asReg()) continue;
+            if (it != holder.end()) ins.src = MOperand::reg(it->second);
+            forget(regBit(ins.dst));
+            if (ins.src.isMem()) hold(slot, ins.dst.asReg());
+        } else {
+            forget(regEffects(ins).writes);
+            if (ins.dst.isMem() && writesDst(ins.op)) {
+                holder.erase(ins.dst.value);
+                if (ins.op == MOp::MOV && ins.bits == 32 && ins.src.isReg()) hold(ins.dst.value, ins.src.asReg());
+            }
+        }
+        code[kept++] = ins;
+    }
+    code.resize(kept);
+}
+
+// Drops mov r, r, the second of mov a, b; mov b, a, and jumps to the
+// label that directly follows them
+static void removeRedundantMoves(vector<MInstr>& code) {
+    size_t kept = 0;
+    for (size_t i = 0; i < code.size(); ++i) {
+        const MInstr& ins = code[i];
+        if (ins.op == MOp::MOV && ins.dst == ins.src) continue;
+        if (ins.op == MOp::MOV && kept > 0) {
+            const MInstr& before = code[kept - 1];
+            bool undoes = before.op == MOp::MOV && before.bits == ins.bits && before.dst == ins.src;
+            if (undoes && before.src == ins.dst) continue;
+        }
+        if ((ins.op == MOp::JMP || ins.op == MOp::JCC) && i + 1 < code.size() && code[i + 1].op == MOp::LABEL &&
+            code[i + 1].dst == ins.dst) {
+            continue;
+        }
+        code[kept++] = code[i];
+    }
+    code.resize(kept);
+}
+
+// Drops the trap stubs no jump reaches any more. A stub is the label,
+// lea rdi, message; call mukku_trap; mov eax, 1; jmp exit that the
+// generator places after the ret, so nothing falls into it.
+static void removeUnusedTrapStubs(vector<MInstr>& code) {
+    unordered_set<long long> targets;
+    for (const MInstr& ins : code) {
+        if (ins.op == MOp::JMP || ins.op == MOp::JCC) targets.insert(ins.dst.value);
+    }
+    auto isStub = [&](size_t i) {
+        return i > 0 && i + 4 < code.size() && code[i].op == MOp::LABEL &&
+               (code[i - 1].op == MOp::RET || code[i - 1].op == MOp::JMP) && code[i + 1].op == MOp::LEA &&
+               code[i + 2].op == MOp::CALL && code[i + 2].dst.value == (int)RuntimeHelper::TRAP &&
+               code[i + 3].op == MOp::MOV && code[i + 4].op == MOp::JMP;
+    };
+    size_t kept = 0;
+    for (size_t i = 0; i < code.size(); ++i) {
+        if (isStub(i) && !targets.count(code[i].dst.value)) {
+            i += 4;
+            continue;
+        }
+        code[kept++] = code[i];
+    }
+    code.resize(kept);
+}
+
+PeepholeStats peepholeOptimize(MachineCode& mc) {
+    size_t before = mc.code.size();
+    foldImmediates(mc.code);
+    size_t added = reduceStrength(mc.code);
+    forwardStores(mc.code);
+    removeRedundantMoves(mc.code);
+    removeUnusedTrapStubs(mc.code);
+    return {"main", before, mc.code.size(), before + added - mc.code.size(), added};
+}
+
+// --- x86-64 encoding, JIT and object files ---
+// MachineCode is assembled into one position-independent blob: the code,
+// then the data strings (each preceded by its 32-bit length), then one
+// stub per runtime helper that the calls jump through.
+
+struct EncodedProgram {
+    vector<uint8_t> bytes;
+    size_t codeSize = 0;
+    vector<pair<size_t, string>> relocations;   // rel32 call sites into libc, for object files
+};
+
+class X86Encoder {
+    vector<uint8_t> out;
+    unordered_map<long long, size_t> labels;
+    vector<pair<size_t, long long>> labelFixups;    // rel32 position -> label
+    vector<pair<size_t, size_t>> dataFixups;        // rel32 position -> data index
+    vector<pair<size_t, int>> helperFixups;         // rel32 position -> helper
+    vector<size_t> dataOffsets;
+    size_t helperOffsets[4] = {};
+
+    static uint8_t condCode(Cond c) {
+        static const uint8_t codes[] = {0x4, 0x5, 0xC, 0xE, 0xF, 0xD};
+        return codes[(int)c];
+    }
+
+    void byte(uint8_t b) { out.push_back(b); }
+
+    void dword(uint32_t v) {
+        for (int i = 0; i < 4; ++i) byte(v >> (8 * i));
+    }
+
+    size_t rel32() {
+        dword(0);
+        return out.size() - 4;
+    }
+
+    static bool fitsByte(long long v) { return v >= -128 && v <= 127; }
+
+    // Opcode with a ModRM operand: 'reg' fills the reg field (a register
+    // or an opcode extension) and 'rm' is a register or stack slot.
+    // 'byteRM' marks rm as a byte register, which needs a REX prefix to
+    // mean sil/dil/spl/bpl rather than dh/bh/ah/ch.
+    void emitRM(initializer_list<uint8_t> opcode, int reg, const MOperand& rm, bool wide, bool byteRM = false) {
+        int base = rm.isReg() ? (int)rm.value : (int)Reg::RBP;
+        uint8_t rex = 0x40 | (wide ? 8 : 0) | (reg >= 8 ? 4 : 0) | (base >= 8 ? 1 : 0);
+        if (rex != 0x40 || (byteRM && rm.isReg() && base >= 4)) byte(rex);
+        for (uint8_t b : opcode) byte(b);
+        if (rm.isReg()) {
+            byte(0xC0 | (reg & 7) << 3 | (base & 7));
+            return;
+        }
+        long long disp = -rm.value;
+        if (fitsByte(disp)) {
+            byte(0x40 | (reg & 7) << 3 | 5);
+            byte(disp);
+        } else {
+            byte(0x80 | (reg & 7) << 3 | 5);
+            dword(disp);
+        }
+    }
+
+    void emitImm(long long v, bool small) {
+        if (small) byte(v);
+        else dword(v);
+    }
+
+    // add/or/.../cmp family: 'rmForm' is the r/m, reg opcode; 'ext' the /digit
+    void emitAlu(uint8_t rmForm, int ext, const MInstr& ins) {
+        bool wide = ins.bits == 64;
+        if (ins.src.isImm()) {
+            bool small = fitsByte(ins.src.value);
+            emitRM({(uint8_t)(small ? 0x83 : 0x81)}, ext, ins.dst, wide);
+            emitImm(ins.src.value, small);
+        } else if (ins.src.isReg()) {
+            emitRM({rmForm}, ins.src.value, ins.dst, wide);
+        } else {
+            emitRM({(uint8_t)(rmForm + 2)}, ins.dst.value, ins.src, wide);
+        }
+    }
+
+    void encode(const MInstr& ins);
+public:
+    // 'jitHelpers' holds the address of each RuntimeHelper for in-process
+    // use. Without it the helpers become tail calls into libc, recorded
+    // as relocations.
+    EncodedProgram assemble(const MachineCode& mc, const void* const* jitHelpers);
+};
+
+void X86Encoder::encode(const MInstr& ins) {
+    bool wide = ins.bits == 64;
+    switch (ins.op) {
+        case MOp::MOV:
+            if (ins.dst.isReg() && ins.src.isImm() && !wide) {
+                if (ins.dst.value >= 8) byte(0x41);
+                byte(0xB8 + (ins.dst.value & 7));
+                dword(ins.src.value);
+            } else if (ins.src.isImm()) {
+                emitRM({0xC7}, 0, ins.dst, wide);
+                dword(ins.src.value);
+            } else if (ins.src.isReg()) {
+                emitRM({0x89}, ins.src.value, ins.dst, wide);
+            } else {
+                emitRM({0x8B}, ins.dst.value, ins.src, wide);
+            }
+            break;
+        case MOp::ADD: emitAlu(0x01, 0, ins); break;
+        case MOp::SUB: emitAlu(0x29, 5, ins); break;
+        case MOp::AND: emitAlu(0x21, 4, ins); break;
+        case MOp::XOR: emitAlu(0x31, 6, ins); break;
+        case MOp::SHL: case MOp::SAR:
+            emitRM({0xC1}, ins.op == MOp::SHL ? 4 : 7, ins.dst, wide);
+            byte(ins.src.value);
+            break;
+        case MOp::CMP: emitAlu(0x39, 7, ins); break;
+        case MOp::TEST: emitRM({0x85}, ins.src.value, ins.dst, wide); break;
+        case MOp::IMUL:
+            if (ins.extra.isImm()) {
+                bool small = fitsByte(ins.extra.value);
+                emitRM({(uint8_t)(small ? 0x6B : 0x69)}, ins.dst.value, ins.src, wide);
+                emitImm(ins.extra.value, small);
+            } else {
+                emitRM({0x0F, 0xAF}, ins.dst.value, ins.src, wide);
+            }
+            break;
+        case MOp::SETCC: emitRM({0x0F, (uint8_t)(0x90 + condCode(ins.cc))}, 0, ins.dst, false, true); break;
+        case MOp::MOVZX: emitRM({0x0F, 0xB6}, ins.dst.value, ins.src, false, true); break;
+        case MOp::CDQ: byte(0x99); break;
+        case MOp::IDIV: emitRM({0xF7}, 7, ins.dst, wide); break;
+        case MOp::JMP:
+            byte(0xE9);
+            labelFixups.push_back({rel32(), ins.dst.value});
+            break;
+        case MOp::JCC:
+            byte(0x0F);
+            byte(0x80 + condCode(ins.cc));
+            labelFixups.push_back({rel32(), ins.dst.value});
+            break;
+        case MOp::LABEL: labels[ins.dst.value] = out.size(); break;
+        case MOp::CALL:
+            byte(0xE8);
+            helperFixups.push_back({rel32(), (int)ins.dst.value});
+            break;
+        case MOp::PUSH: case MOp::POP:
+            if (ins.dst.value >= 8) byte(0x41);
+            byte((ins.op == MOp::PUSH ? 0x50 : 0x58) + (ins.dst.value & 7));
+            break;
+        case MOp::RET: byte(0xC3); break;
+        case MOp::LEA:
+            byte(ins.dst.value >= 8 ? 0x4C : 0x48);
+            byte(0x8D);
+            byte((ins.dst.value & 7) << 3 | 5);      // [rip + disp32]
+            dataFixups.push_back({rel32(), (size_t)ins.src.value});
+            break;
+    }
+}
+
+EncodedProgram X86Encoder::assemble(const MachineCode& mc, const void* const* jitHelpers) {
+    EncodedProgram program;
+    for (const MInstr& ins : mc.code) encode(ins);
+    program.codeSize = out.size();
+
+    auto addData = [&](const string& text) {
+        dword(text.size());
+        dataOffsets.push_back(out.size());
+        out.insert(out.end(), text.begin(), text.end());
+        byte(0);
+    };
+    for (const string& text : mc.data) addData(text);
+
+    if (jitHelpers) {
+        // jmp qword ptr [rip + 0] followed by the absolute address
+        for (int h = 0; h < 4; ++h) {
+            helperOffsets[h] = out.size();
+            byte(0xFF);
+            byte(0x25);
+            dword(0);
+            uint64_t address = (uint64_t)(uintptr_t)jitHelpers[h];
+            for (int i = 0; i < 8; ++i) byte(address >> (8 * i));
+        }
+    } else {
+        // printf/puts/dprintf with the formats the VM uses
+        size_t formats = mc.data.size();
+        addData("%d\n");
+        addData("Return: %d\n");
+        addData("Runtime error: %s\n");
+        auto leaFormat = [&](uint8_t modrm, size_t index) {
+            byte(0x48);
+            byte(0x8D);
+            byte(modrm);
+            dataFixups.push_back({rel32(), index});
+        };
+        auto xorEax = [&] { byte(0x31); byte(0xC0); };
+        auto jumpTo = [&](const char* symbol) {
+            byte(0xE9);
+            program.relocations.push_back({rel32(), symbol});
+        };
+        helperOffsets[(int)RuntimeHelper::PRINT_INT] = out.size();
+        byte(0x89); byte(0xFE);                 // mov esi, edi
+        leaFormat(0x3D, formats);               // lea rdi, [rip + "%d\n"]
+        xorEax();
+        jumpTo("printf");
+        helperOffsets[(int)RuntimeHelper::PRINT_STR] = out.size();
+        jumpTo("puts");
+        helperOffsets[(int)RuntimeHelper::RETURN] = out.size();
+        byte(0x89); byte(0xFE);
+        leaFormat(0x3D, formats + 1);
+        xorEax();
+        jumpTo("printf");
+        helperOffsets[(int)RuntimeHelper::TRAP] = out.size();
+        byte(0x48); byte(0x89); byte(0xFA);     // mov rdx, rdi
+        byte(0xBF); dword(2);                   // mov edi, 2
+        leaFormat(0x35, formats + 2);           // lea rsi, [rip + format]
+        xorEax();
+        jumpTo("dprintf");
+    }
+
+    auto patch = [&](size_t at, size_t target) {
+        uint32_t rel = (uint32_t)(target - (at + 4));
+        for (int i = 0; i < 4; ++i) out[at + i] = rel >> (8 * i);
+    };
+    for (const auto& fixup : labelFixups) patch(fixup.first, labels[fixup.second]);
+    for (const auto& fixup : dataFixups) patch(fixup.first, dataOffsets[fixup.second]);
+    for (const auto& fixup : helperFixups) patch(fixup.first, helperOffsets[fixup.second]);
+    program.bytes = move(out);
+    return program;
+}
+
+// Writes a relocatable ELF64 object defining 'main', so `cc prog.o`
+// links a standalone executable against libc
+bool writeElfObject(const EncodedProgram& program, const string& path, string& error) {
+    vector<uint8_t> file;
+    auto put = [&](uint64_t v, int size) {
+        for (int i = 0; i < size; ++i) file.push_back(v >> (8 * i));
+    };
+    auto align = [&](size_t to) {
+        while (file.size() % to) file.push_back(0);
+    };
+
+    // Symbols: null, main, then the libc functions the stubs jump to
+    vector<string> imports;
+    for (const auto& reloc : program.relocations) {
+        if (find(imports.begin(), imports.end(), reloc.second) == imports.end()) imports.push_back(reloc.second);
+    }
+    string strtab = string(1, '\0') + "main" + '\0';
+    vector<size_t> importNames;
+    for (const string& name : imports) {
+        importNames.push_back(strtab.size());
+        strtab += name + '\0';
+    }
+    const char* sectionNames[] = {"", ".text", ".rela.text", ".symtab", ".strtab", ".shstrtab", ".note.GNU-stack"};
+    string shstrtab;
+    vector<size_t> nameOffsets;
+    for (const char* name : sectionNames) {
+        nameOffsets.push_back(shstrtab.size());
+        shstrtab += string(name) + '\0';
+    }
+
+    file.resize(64);                                  // ELF header, filled in last
+    size_t textOffset = file.size();
+    file.insert(file.end(), program.bytes.begin(), program.bytes.end());
+    align(8);
+    size_t relaOffset = file.size();
+    for (const auto& reloc : program.relocations) {
+        size_t symbol = 2 + (find(imports.begin(), imports.end(), reloc.second) - imports.begin());
+        put(reloc.first, 8);                          // r_offset
+        put(symbol << 32 | 4, 8);                     // r_info: R_X86_64_PLT32
+        put((uint64_t)-4, 8);                         // r_addend
+    }
+    size_t symtabOffset = file.size();
+    file.resize(file.size() + 24);                    // null symbol
+    put(1, 4); put(0x12, 1); put(0, 1); put(1, 2);   // main: GLOBAL FUNC in .text
+    put(0, 8); put(program.codeSize, 8);
+    for (size_t name : importNames) {
+        put(name, 4); put(0x10, 1); put(0, 1); put(0, 2);   // GLOBAL NOTYPE, undefined
+        put(0, 8); put(0, 8);
+    }
+    size_t strtabOffset = file.size();
+    file.insert(file.end(), strtab.begin(), strtab.end());
+    size_t shstrtabOffset = file.size();
+    file.insert(file.end(), shstrtab.begin(), shstrtab.end());
+    align(8);
+    size_t sectionHeaders = file.size();
+
+    auto section = [&](int index, uint32_t type, uint64_t flags, size_t offset, size_t size,
+                       uint32_t link, uint32_t info, uint64_t alignment, uint64_t entsize) {
+        put(nameOffsets[index], 4); put(type, 4); put(flags, 8); put(0, 8);
+        put(offset, 8); put(size, 8); put(link, 4); put(info, 4); put(alignment, 8); put(entsize, 8);
+    };
+    file.resize(file.size() + 64);                    // null section
+    section(1, 1, 0x6, textOffset, program.bytes.size(), 0, 0, 16, 0);              // PROGBITS, AX
+    section(2, 4, 0x40, relaOffset, 24 * program.relocations.size(), 3, 1, 8, 24);  // RELA, INFO_LINK
+    section(3, 2, 0, symtabOffset, 24 * (2 + imports.size()), 4, 1, 8, 24);         // SYMTAB
+    section(4, 3, 0, strtabOffset, strtab.size(), 0, 0, 1, 0);                     // STRTAB
+    section(5, 3, 0, shstrtabOffset, shstrtab.size(), 0, 0, 1, 0);
+    section(6, 1, 0, shstrtabOffset, 0, 0, 0, 1, 0);                                // non-executable stack
+
+    static const uint8_t ident[16] = {0x7F, 'E', 'L', 'F', 2, 1, 1};                 // 64-bit, LSB, v1
+    copy(ident, ident + 16, file.begin());
+    size_t at = 16;
+    auto set = [&](uint64_t v, int size) {
+        for (int i = 0; i < size; ++i) file[at++] = v >> (8 * i);
+    };
+    set(1, 2); set(62, 2); set(1, 4);                 // ET_REL, EM_X86_64, EV_CURRENT
+    set(0, 8); set(0, 8); set(sectionHeaders, 8);     // entry, phoff, shoff
+    set(0, 4); set(64, 2); set(0, 2); set(0, 2);      // flags, ehsize, phentsize, phnum
+    set(64, 2); set(7, 2); set(5, 2);                 // shentsize, shnum, shstrndx
+
+    ofstream outFile(path, ios::binary);
+    if (!outFile.write((const char*)file.data(), file.size())) {
+        error = "could not write '" + path + "'";
+        return false;
+    }
+    return true;
+}
+
+#ifdef MUKKU_JIT
+// Runtime helpers for in-process execution. They write to the stream of
+// the compilation running on this thread, exactly as the VM would.
+struct JitContext {
+    ostream* out;
+    string runtimeError;
+};
+
+static thread_local JitContext* jitContext = nullptr;
+
+static void jitPrintInt(int value) { *jitContext->out << value << '\n'; }
+
+static void jitPrintString(const char* text) {
+    uint32_t length;
+    memcpy(&length, text - 4, 4);
+    jitContext->out->write(text, length) << '\n';
+}
+
+static void jitReturn(int value) { *jitContext->out << "Return: " << value << '\n'; }
+
+static void jitTrap(const char* message) {
+    uint32_t length;
+    memcpy(&length, message - 4, 4);
+    jitContext->runtimeError.assign(message, length);
+}
+
+// Runs the program natively. Returns false if executable memory is not
+// available, so the caller can fall back to the VM; otherwise 'ok'
+// reports whether the program finished without a runtime error.
+bool runJit(const MachineCode& mc, ostream& out, bool& ok, string& runtimeError) {
+    static const void* const helpers[] = {(const void*)jitPrintInt, (const void*)jitPrintString,
+                                          (const void*)jitReturn, (const void*)jitTrap};
+    EncodedProgram program = X86Encoder().assemble(mc, helpers);
+
+    size_t size = max<size_t>(program.bytes.size(), 1);
+    void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) return false;
+    memcpy(memory, program.bytes.data(), program.bytes.size());
+    if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, size);
+        return false;
+    }
+
+    JitContext context{&out, ""};
+    jitContext = &context;
+    ok = ((int (*)())memory)() == 0;
+    jitContext = nullptr;
+    munmap(memory, size);
+    runtimeError = context.runtimeError;
+    return true;
+}
+#endif
+
+// Bytecode for the register VM. Every operand is a register index; the
+// register file holds variable slots, then expression temporaries, then
+// the constant pool, so instructions never decode immediates.
+enum class OpCode : uint8_t {
+    MOVE, ADD, SUB, MUL, DIV, EQ, NE, LT, LE, GT, GE,
+    JMPF, JMP, PRINT, PRINTS, RET, TRAP, HALT
+};
+
+struct Instr {
+    OpCode op;
+    int32_t a = 0, b = 0, c = 0;
+};
+
+struct Bytecode {
+    vector<Instr> code;
+    vector<int> constants;
+    vector<string_view> strings;      // PRINTS payloads, already unquoted
+    vector<string> trapMessages;
+    size_t slotCount = 0;             // variables, addressed by symbol table slot
+    size_t tempCount = 0;
+
+    size_t registerCount() const { return slotCount + tempCount + constants.size(); }
+};
+
+// Lowers the AST to bytecode. Constant subexpressions are folded and
+// variables are resolved to their slots at compile time.
+class BytecodeCompiler {
+    const AST& ast;
+    const vector<int>& slots;          // node ID -> slot of the variable it names
+    Bytecode& bc;
+    unordered_map<int, int> constantIndex;
+    int tempTop = 0;
+
+    // Constants are encoded as negative operands until compile() knows
+    // how many temporaries precede the constant pool.
+    static bool isConstant(int reg) { return reg < 0; }
+
+    int constant(int value) {
+        auto it = constantIndex.find(value);
+        if (it != constantIndex.end()) return it->second;
+        int reg = -(int)bc.constants.size() - 1;
+        bc.constants.push_back(value);
+        constantIndex.emplace(value, reg);
+        return reg;
+    }
+
+    int constantValue(int reg) const { return bc.constants[-reg - 1]; }
+
+    int allocTemp() {
+        int reg = bc.slotCount + tempTop++;
+        bc.tempCount = max(bc.tempCount, (size_t)tempTop);
+        return reg;
+    }
+
+    size_t emit(OpCode op, int a = 0, int b = 0, int c = 0) {
+        Instr ins;
+        ins.op = op;
+        ins.a = a;
+        ins.b = b;
+        ins.c = c;
+        bc.code.push_back(ins);
+        return bc.code.size() - 1;
+    }
+
+    static OpCode opcodeFor(BinOp op) {
+        switch (op) {
+            case BinOp::ADD: return OpCode::ADD;
+            case BinOp::SUB: return OpCode::SUB;
+            case BinOp::MUL: return OpCode::MUL;
+            case BinOp::DIV: return OpCode::DIV;
+            case BinOp::EQ: return OpCode::EQ;
+            case BinOp::NE: return OpCode::NE;
+            case BinOp::LT: return OpCode::LT;
+            case BinOp::LE: return OpCode::LE;
+            case BinOp::GT: return OpCode::GT;
+            case BinOp::GE: return OpCode::GE;
+        }
+        return OpCode::ADD;
+    }
+
+    // Folds with the same wrapping behaviour as the VM; division that
+    // would trap at run time is left for the VM to report.
+    static bool fold(BinOp op, int l, int r, int& out) {
+        unsigned ul = l, ur = r;
+        switch (op) {
+            case BinOp::ADD: out = (int)(ul + ur); return true;
+            case BinOp::SUB: out = (int)(ul - ur); return true;
+            case BinOp::MUL: out = (int)(ul * ur); return true;
+            case BinOp::DIV:
+                if (r == 0 || (l == INT_MIN && r == -1)) return false;
+                out = l / r; return true;
+            case BinOp::EQ: out = l == r; return true;
+            case BinOp::NE: out = l != r; return true;
+            case BinOp::LT: out = l < r; return true;
+            case BinOp::LE: out = l <= r; return true;
+            case BinOp::GT: out = l > r; return true;
+            case BinOp::GE: out = l >= r; return true;
+        }
+        return false;
+    }
+
+    // An operator waiting for its operands. 'mark' is tempTop when its
+    // operands were started; 'leftDone' is set once the left one is.
+    struct ExprFrame {
+        NodeId id;
+        int dest;
+        int mark;
+        bool leftDone;
+    };
+
+    // A block or agar being compiled: the next child of a block, or for
+    // agar which of its blocks has been compiled and the jumps to patch
+    struct StmtFrame {
+        NodeId id;
+        uint32_t stage;
+        size_t jumpElse, jumpEnd;
+    };
+
+    vector<ExprFrame> pendingExprs;
+    vector<int> operands;              // left operands waiting for the right one
+    vector<StmtFrame> frames;
+
+    int leaf(NodeId id) {
+        const ASTNode& node = ast[id];
+        switch (node.kind) {
+            case NodeKind::NumberLiteral: {
+                int value = 0;
+                auto res = from_chars(node.value.data(), node.value.data() + node.value.size(), value);
+                if (res.ec != errc()) {
+                    bc.trapMessages.push_back("integer literal '" + string(node.value) + "' is out of range");
+                    emit(OpCode::TRAP, bc.trapMessages.size() - 1);
+                    return constant(0);
+                }
+                return constant(value);
+            }
+            case NodeKind::Identifier:
+                return slots[id];
+            default:
+                return constant(0);
+        }
+    }
+
+    // Returns the register holding the expression's value. 'dest' is used
+    // for the result when the expression needs an instruction of its own.
+    int expression(NodeId id, int dest = -1) {
+        NodeId next = id;
+        for (;;) {
+            while (ast[next].kind == NodeKind::BinaryExpr) {
+                pendingExprs.push_back({next, next == id ? dest : -1, tempTop, false});
+                next = ast.child(next, 0);
+            }
+            int value = leaf(next);
+            // Compile every operator whose right operand this value completes
+            for (;;) {
+                if (pendingExprs.empty()) return value;
+                ExprFrame& frame = pendingExprs.back();
+                if (!frame.leftDone) {
+                    frame.leftDone = true;
+                    operands.push_back(value);
+                    next = ast.child(frame.id, 1);
+                    break;
+                }
+                ExprFrame done = frame;
+                pendingExprs.pop_back();
+                int left = operands.back();
+                operands.pop_back();
+                BinOp op = ast[done.id].op;
+                int folded;
+                tempTop = done.mark;
+                if (isConstant(left) && isConstant(value) &&
+                    fold(op, constantValue(left), constantValue(value), folded)) {
+                    value = constant(folded);
+                    continue;
+                }
+                if (done.dest < 0) done.dest = allocTemp();
+                emit(opcodeFor(op), done.dest, left, value);
+                value = done.dest;
+            }
+        }
+    }
+
+    // Compiles a statement that holds no other statements
+    void simpleStatement(NodeId id) {
+        const ASTNode& node = ast[id];
+        switch (node.kind) {
+            case NodeKind::Declaration: {
+                int slot = slots[id];
+                int src = node.childCount ? expression(ast.child(id, 0), slot) : constant(0);
+                if (src != slot) emit(OpCode::MOVE, slot, src);
+                break;
+            }
+            case NodeKind::Print:
+                if (node.childCount) {
+                    const ASTNode& arg = ast[ast.child(id, 0)];
+                    if (arg.kind == NodeKind::StringLiteral) {
+                        // Remove quotes from string literal
+                        string_view s = arg.value;
+                        if (s.size() >= 2 && s.front() == '"' && s.back() == '"')
+                            s = s.substr(1, s.size()-2);
+                        bc.strings.push_back(s);
+                        emit(OpCode::PRINTS, bc.strings.size() - 1);
+                    } else {
+                        emit(OpCode::PRINT, expression(ast.child(id, 0)));
+                    }
+                }
+                break;
+            case NodeKind::Return:
+                emit(OpCode::RET, expression(ast.child(id, 0)));
+                break;
+            default:
+                break;
+        }
+        tempTop = 0;
+    }
+
+    static bool nests(NodeKind kind) {
+        return kind == NodeKind::Program || kind == NodeKind::Block || kind == NodeKind::IfElse;
+    }
+
+    void statement(NodeId id) {
+        if (!nests(ast[id].kind)) return simpleStatement(id);
+        frames.assign(1, {id, 0, 0, 0});
+        while (!frames.empty()) {
+            StmtFrame& frame = frames.back();
+            const ASTNode& node = ast[frame.id];
+            NodeId next = NO_NODE;
+            if (node.kind != NodeKind::IfElse) {
+                if (frame.stage < node.childCount) next = ast.child(frame.id, frame.stage++);
+            } else if (frame.stage == 0) {
+                int cond = expression(ast.child(frame.id, 0));
+                if (isConstant(cond)) {
+                    // Only the branch that can run is compiled
+                    frame.stage = 3;
+                    if (constantValue(cond)) next = ast.child(frame.id, 1);
+                    else if (node.childCount > 2) next = ast.child(frame.id, 2);
+                } else {
+                    frame.jumpElse = emit(OpCode::JMPF, cond);
+                    frame.stage = 1;
+                    next = ast.child(frame.id, 1);
+                }
+            } else if (frame.stage == 1 && node.childCount > 2) {
+                frame.jumpEnd = emit(OpCode::JMP);
+                bc.code[frame.jumpElse].b = bc.code.size();
+                frame.stage = 2;
+                next = ast.child(frame.id, 2);
+            } else if (frame.stage == 1) {
+                bc.code[frame.jumpElse].b = bc.code.size();
+            } else if (frame.stage == 2) {
+                bc.code[frame.jumpEnd].a = bc.code.size();
+            }
+
+            if (next == NO_NODE) {
+                frames.pop_back();
+                tempTop = 0;
+            } else if (nests(ast[next].kind)) {
+                frames.push_back({next, 0, 0, 0});
+            } else {
+                simpleStatement(next);
+            }
+        }
+    }
+
+    // Rewrites the placeholder constant operands to their final registers
+    void relocateConstants() {
+        int base = bc.slotCount + bc.tempCount;
+        auto fix = [base](int32_t& reg) { if (reg < 0) reg = base + (-reg - 1); };
+        for (Instr& ins : bc.code) {
+            switch (ins.op) {
+                case OpCode::MOVE: fix(ins.b); break;
+                case OpCode::JMPF: case OpCode::PRINT: case OpCode::RET: fix(ins.a); break;
+                case OpCode::JMP: case OpCode::PRINTS: case OpCode::TRAP: case OpCode::HALT: break;
+                default: fix(ins.b); fix(ins.c); break;
+            }
+        }
+    }
+
+public:
+    BytecodeCompiler(const AST& tree, const vector<int>& nodeSlots, Bytecode& out)
+        : ast(tree), slots(nodeSlots), bc(out) {}
+
+    void compile(NodeId root, size_t symbolCount) {
+        bc.slotCount = symbolCount;
+        if (root != NO_NODE) statement(root);
+        emit(OpCode::HALT);
+        relocateConstants();
+    }
+};
+
+// Resources one program run may use; 0 leaves a resource unlimited
+struct ExecutionLimits {
+    uint64_t instructions = 0;        // VM instructions dispatched
+    uint64_t memoryBytes = 0;         // the register file
+    uint64_t outputBytes = 0;         // bytes the program prints
+    uint64_t timeMillis = 0;          // wall clock from the start of the request
+};
+
+enum class ExecutionLimit : uint8_t { None, Instructions, Memory, Output, Time };
+
+const char* executionLimitName(ExecutionLimit limit) {
+    switch (limit) {
+        case ExecutionLimit::None: return "none";
+        case ExecutionLimit::Instructions: return "instructions";
+        case ExecutionLimit::Memory: return "memory";
+        case ExecutionLimit::Output: return "output";
+        case ExecutionLimit::Time: return "time";
+    }
+    return "";
+}
+
+// Passes writes on to another stream buffer until 'limit' bytes have
+// gone through, then fails them; the stream writing through it goes bad
+class CappedStreambuf : public streambuf {
+    streambuf* target;
+    uint64_t remaining;
+    bool overflowed = false;
+
+protected:
+    int overflow(int c) override {
+        if (c == traits_type::eof()) return traits_type::not_eof(c);
+        if (remaining == 0) {
+            overflowed = true;
+            return traits_type::eof();
+        }
+        --remaining;
+        return target->sputc(traits_type::to_char_type(c));
+    }
+
+    streamsize xsputn(const char* s, streamsize n) override {
+        streamsize fits = (uint64_t)n > remaining ? (streamsize)remaining : n;
+        if (fits < n) overflowed = true;
+        remaining -= fits;
+        return target->sputn(s, fits);
+    }
+
+public:
+    CappedStreambuf(streambuf* to, uint64_t limit) : target(to), remaining(limit) {}
+
+    // Whether a write was cut short by the limit
+    bool exceeded() const { return overflowed; }
+};
+
+// Register VM executing Bytecode. Dispatch uses computed goto where the
+// compiler supports it and falls back to a switch otherwise.
+class VM {
+    const Bytecode& bc;
+    vector<int> registers;
+    uint64_t maxSteps = UINT64_MAX;
+    chrono::steady_clock::time_point deadline = chrono::steady_clock::time_point::max();
+
+    // The deadline is looked at once per this many instructions
+    static constexpr uint64_t DEADLINE_STRIDE = 1 << 16;
+
+    // Dispatch counts against one bound, the nearest of the instruction
+    // budget and the next deadline check, and only comes here on reaching
+    // it. Returns false once a limit is exceeded.
+    bool withinLimits(uint64_t steps, uint64_t& checkAt) {
+        if (steps > maxSteps) {
+            exceeded = ExecutionLimit::Instructions;
+            runtimeError = "instruction limit of " + to_string(maxSteps) + " exceeded";
+            return false;
+        }
+        bool timed = deadline != chrono::steady_clock::time_point::max();
+        if (timed && chrono::steady_clock::now() >= deadline) {
+            exceeded = ExecutionLimit::Time;
+            runtimeError = "time limit exceeded";
+            return false;
+        }
+        checkAt = maxSteps == UINT64_MAX ? UINT64_MAX : maxSteps + 1;
+        if (timed) checkAt = min(checkAt, steps + DEADLINE_STRIDE);
+        return true;
+    }
+
+public:
+    string runtimeError;
+    size_t executed = 0;          // instructions dispatched by the last run()
+    ExecutionLimit exceeded = ExecutionLimit::None;   // the limit that stopped the last run()
+
+    explicit VM(const Bytecode& code) : bc(code), registers(code.registerCount(), 0) {
+        copy(bc.constants.begin(), bc.constants.end(), registers.begin() + bc.slotCount + bc.tempCount);
+    }
+
+    // Returns false if execution stopped on a runtime error or at a limit.
+    // Memory is the caller's to check, before the register file is built.
+    bool run(ostream& out, const ExecutionLimits& limits = ExecutionLimits(),
+             chrono::steady_clock::time_point until = chrono::steady_clock::time_point::max()) {
+        int* r = registers.data();
+        const Instr* code = bc.code.data();
+        const Instr* pc = code;
+        uint64_t steps = 0;
+        maxSteps = limits.instructions ? limits.instructions : UINT64_MAX;
+        deadline = until;
+        uint64_t checkAt = 1;
+        bool capped = limits.outputBytes != 0;
+
+#if defined(__GNUC__)
+        static void* const dispatch[] = {
+            &&op_MOVE, &&op_ADD, &&op_SUB, &&op_MUL, &&op_DIV, &&op_EQ, &&op_NE, &&op_LT, &&op_LE,
+            &&op_GT, &&op_GE, &&op_JMPF, &&op_JMP, &&op_PRINT, &&op_PRINTS, &&op_RET, &&op_TRAP, &&op_HALT
+        };
+#define VM_CASE(name) op_##name
+#define VM_NEXT() do {                                                            \
+            if (++steps >= checkAt && !withinLimits(steps, checkAt)) goto stopped;  \
+            goto *dispatch[(int)pc->op];                                          \
+        } while (0)
+        VM_NEXT();
+#else
+#define VM_CASE(name) case OpCode::name
+#define VM_NEXT() goto next
+    next:
+        if (++steps >= checkAt && !withinLimits(steps, checkAt)) goto stopped;
+        switch (pc->op) {
+#endif
+        VM_CASE(MOVE): r[pc->a] = r[pc->b]; ++pc; VM_NEXT();
+        VM_CASE(ADD): r[pc->a] = (int)((unsigned)r[pc->b] + (unsigned)r[pc->c]); ++pc; VM_NEXT();
+        VM_CASE(SUB): r[pc->a] = (int)((unsigned)r[pc->b] - (unsigned)r[pc->c]); ++pc; VM_NEXT();
+        VM_CASE(MUL): r[pc->a] = (int)((unsigned)r[pc->b] * (unsigned)r[pc->c]); ++pc; VM_NEXT();
+        VM_CASE(DIV):
+            if (r[pc->c] == 0 || (r[pc->b] == INT_MIN && r[pc->c] == -1)) {
+                runtimeError = r[pc->c] == 0 ? "division by zero" : "integer overflow in division";
+                executed = steps;
+                return false;
+            }
+            r[pc->a] = r[pc->b] / r[pc->c]; ++pc; VM_NEXT();
+        VM_CASE(EQ): r[pc->a] = r[pc->b] == r[pc->c]; ++pc; VM_NEXT();
+        VM_CASE(NE): r[pc->a] = r[pc->b] != r[pc->c]; ++pc; VM_NEXT();
+        VM_CASE(LT): r[pc->a] = r[pc->b] < r[pc->c]; ++pc; VM_NEXT();
+        VM_CASE(LE): r[pc->a] = r[pc->b] <= r[pc->c]; ++pc; VM_NEXT();
+        VM_CASE(GT): r[pc->a] = r[pc->b] > r[pc->c]; ++pc; VM_NEXT();
+        VM_CASE(GE): r[pc->a] = r[pc->b] >= r[pc->c]; ++pc; VM_NEXT();
+        VM_CASE(JMPF): pc = r[pc->a] ? pc + 1 : code + pc->b; VM_NEXT();
+        VM_CASE(JMP): pc = code + pc->a; VM_NEXT();
+        VM_CASE(PRINT): out << r[pc->a] << '\n'; ++pc; goto printed;
+        VM_CASE(PRINTS): out << bc.strings[pc->a] << '\n'; ++pc; goto printed;
+        VM_CASE(RET): out << "Return: " << r[pc->a] << '\n'; ++pc; goto printed;
+        VM_CASE(TRAP): runtimeError = bc.trapMessages[pc->a]; executed = steps; return false;
+        VM_CASE(HALT): executed = steps; return true;
+#if !defined(__GNUC__)
+        }
+        executed = steps;
+        return true;
+#endif
+    printed:
+        // A capped stream goes bad on the write that overran it
+        if (!capped || out) VM_NEXT();
+        exceeded = ExecutionLimit::Output;
+        runtimeError = "output limit of " + to_string(limits.outputBytes) + " bytes exceeded";
+        executed = steps;
+        return false;
+    stopped:
+        executed = steps - 1;
+        return false;
+#undef VM_CASE
+#undef VM_NEXT
+    }
+};
+
+
+enum class OutputFormat { Text, Json };
+
+// Parts of the listing a compilation can produce. Asking for one also
+// runs the phases it depends on; the others are skipped.
+enum class Phase : uint8_t { Source, Tokens, Ast, Symbols, Tac, Optimized, Assembly, Run };
+
+static const char* const PHASE_NAMES[] = {"source", "tokens", "ast", "symbols", "tac", "optimized", "assembly", "run"};
+const uint32_t ALL_PHASES = (1u << size(PHASE_NAMES)) - 1;
+
+// Per-compilation settings shared by the command line, batch and worker modes
+struct CompileOptions {
+    OutputFormat format = OutputFormat::Text;
+    bool jit = true;                 // run natively where supported, else on the VM
+    string objectPath;               // also write the program as an ELF object
+    size_t parseThreads = 0;         // 0: one per hardware thread
+    bool stats = false;              // append a JSON report of the phases to the error stream
+    string tracePath;                // write the phases as Chrome trace events
+    ExecutionLimits limits;          // for running the compiled program
+    uint32_t phases = ALL_PHASES;    // bit per Phase to list
+
+    bool lists(Phase phase) const { return phases >> (int)phase & 1; }
+};
+
+// Reads '--phases=NAME,...' into a Phase mask
+static bool parsePhasesFlag(string_view arg, uint32_t& phases) {
+    if (arg.substr(0, 9) != "--phases=") return false;
+    uint32_t mask = 0;
+    for (string_view names = arg.substr(9); !names.empty();) {
+        size_t comma = names.find(',');
+        string_view name = names.substr(0, comma);
+        auto known = find(begin(PHASE_NAMES), end(PHASE_NAMES), name);
+        if (known == end(PHASE_NAMES)) return false;
+        mask |= 1u << (known - begin(PHASE_NAMES));
+        names = comma == string_view::npos ? string_view() : names.substr(comma + 1);
+    }
+    phases = mask;
+    return true;
+}
+
+// Exit status of a program stopped at one of its execution limits
+const int LIMIT_EXCEEDED_STATUS = 3;
+
+// Reads the value of a '--name=N' flag whose name is 'prefix'
+static bool parseCountFlag(string_view arg, string_view prefix, uint64_t& value) {
+    if (arg.substr(0, prefix.size()) != prefix) return false;
+    auto [end, ec] = from_chars(arg.data() + prefix.size(), arg.data() + arg.size(), value);
+    return ec == errc() && end == arg.data() + arg.size();
+}
+
+// Applies one '--name=value' flag; returns false if 'arg' is not an option
+bool parseCompileOption(string_view arg, CompileOptions& options) {
+    if (arg == "--format=text") options.format = OutputFormat::Text;
+    else if (arg == "--format=json") options.format = OutputFormat::Json;
+    else if (arg == "--backend=jit") options.jit = true;
+    else if (arg == "--backend=vm") options.jit = false;
+    else if (arg.substr(0, 14) == "--emit-object=") options.objectPath = string(arg.substr(14));
+    else if (arg.substr(0, 16) == "--parse-threads=") {
+        size_t threads = 0;
+        auto [end, ec] = from_chars(arg.data() + 16, arg.data() + arg.size(), threads);
+        if (ec != errc() || end != arg.data() + arg.size() || threads > 256) return false;
+        options.parseThreads = threads;
+    }
+    else if (arg == "--stats") options.stats = true;
+    else if (arg.substr(0, 8) == "--trace=") options.tracePath = string(arg.substr(8));
+    else if (parseCountFlag(arg, "--max-instructions=", options.limits.instructions)) {}
+    else if (parseCountFlag(arg, "--max-memory=", options.limits.memoryBytes)) {}
+    else if (parseCountFlag(arg, "--max-output=", options.limits.outputBytes)) {}
+    else if (parseCountFlag(arg, "--time-limit=", options.limits.timeMillis)) {}
+    else if (parsePhasesFlag(arg, options.phases)) {}
+    else return false;
+    return true;
+}
+
+// --- Instrumentation ---
+// Wall time, CPU time and allocations per phase of one compilation, with
+// the sizes of what each phase produced. Reported as JSON (--stats) or as
+// Chrome trace events (--trace=FILE).
+
+// Allocations made by the calling thread, counted by the global operator
+// new below while an instrumented compilation runs on it. A compilation
+// runs on one thread, so the change across a phase is that phase's
+// allocations; work handed to the parse pool is not included.
+struct AllocCounters {
+    uint64_t count = 0;
+    uint64_t bytes = 0;
+    bool enabled = false;
+};
+thread_local AllocCounters threadAllocs;
+
+void* operator new(size_t size) {
+    if (threadAllocs.enabled) {
+        ++threadAllocs.count;
+        threadAllocs.bytes += size;
+    }
+    while (true) {
+        if (void* p = malloc(size ? size : 1)) return p;
+        new_handler handler = get_new_handler();
+        if (!handler) throw bad_alloc();
+        handler();
+    }
+}
+
+// The other forms go through the one above, and every delete frees what
+// it malloc'd. Kept out of line so GCC doesn't see free() inlined on an
+// operator new block and warn about a mismatch.
+#ifdef __GNUC__
+#define MUKKU_NOINLINE __attribute__((noinline))
+#else
+#define MUKKU_NOINLINE
+#endif
+void* operator new[](size_t size) { return operator new(size); }
+void* operator new(size_t size, const nothrow_t&) noexcept {
+    try {
+        return operator new(size);
+    } catch (const bad_alloc&) {
+        return nullptr;
+    }
+}
+void* operator new[](size_t size, const nothrow_t&) noexcept { return operator new(size, nothrow); }
+MUKKU_NOINLINE void operator delete(void* p) noexcept { free(p); }
+MUKKU_NOINLINE void operator delete[](void* p) noexcept { free(p); }
+MUKKU_NOINLINE void operator delete(void* p, size_t) noexcept { free(p); }
+MUKKU_NOINLINE void operator delete[](void* p, size_t) noexcept { free(p); }
+MUKKU_NOINLINE void operator delete(void* p, const nothrow_t&) noexcept { free(p); }
+MUKKU_NOINLINE void operator delete[](void* p, const nothrow_t&) noexcept { free(p); }
+
+static double threadCpuMicros() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+struct PhaseRecord {
+    const char* name;
+    double startMicros;           // since the compilation began
+    double wallMicros;
+    double cpuMicros;
+    uint64_t allocations;
+    uint64_t allocatedBytes;
+};
+
+class CompileStats {
+public:
+    vector<PhaseRecord> phases;
+    PhaseRecord total{"compile", 0, 0, 0, 0, 0};
+    size_t tokens = 0, astNodes = 0, symbols = 0;
+    size_t tacInstructions = 0, optimizedInstructions = 0, machineInstructions = 0;
+    size_t storageSlots = 0;      // variables and temporaries codegen allocated
+    size_t vmInstructions = 0;    // executed; programs run natively leave it 0
+    bool cached = false;
+
+    // Times one phase from construction to destruction; a null 'stats'
+    // records nothing. Phases may nest.
+    class Scope {
+    public:
+        Scope(CompileStats* s, const char* n) : stats(s), name(n) {
+            if (!stats) return;
+            allocs = threadAllocs;
+            cpu = threadCpuMicros();
+            start = chrono::steady_clock::now();
+        }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+        ~Scope() {
+            if (!stats) return;
+            chrono::steady_clock::time_point end = chrono::steady_clock::now();
+            stats->phases.push_back({name, micros(stats->began, start), micros(start, end), threadCpuMicros() - cpu,
+                                     threadAllocs.count - allocs.count, threadAllocs.bytes - allocs.bytes});
+        }
+
+    private:
+        CompileStats* stats;
+        const char* name;
+        AllocCounters allocs;
+        double cpu = 0;
+        chrono::steady_clock::time_point start;
+    };
+
+    // Starts a new compilation; allocations on this thread are counted
+    // from here on if 'countAllocations', and not at all otherwise
+    void begin(bool countAllocations) {
+        threadAllocs.enabled = countAllocations;
+        phases.clear();
+        tokens = astNodes = symbols = 0;
+        tacInstructions = optimizedInstructions = machineInstructions = storageSlots = vmInstructions = 0;
+        cached = false;
+        began = chrono::steady_clock::now();
+        beganCpu = threadCpuMicros();
+        beganAllocs = threadAllocs;
+    }
+
+    // Closes the compilation's total; phases are listed by start time,
+    // enclosing ones before those nested in them
+    void finish() {
+        stable_sort(phases.begin(), phases.end(), [](const PhaseRecord& a, const PhaseRecord& b) {
+            return a.startMicros < b.startMicros;
+        });
+        total.wallMicros = micros(began, chrono::steady_clock::now());
+        total.cpuMicros = threadCpuMicros() - beganCpu;
+        total.allocations = threadAllocs.count - beganAllocs.count;
+        total.allocatedBytes = threadAllocs.bytes - beganAllocs.bytes;
+    }
+
+    void writeJson(ostream& out) const {
+        JsonWriter json(out);
+        json.beginObject();
+        writeCosts(json, total, 1e-3, "_ms");
+        json.key("peak_rss_kb").value(peakRssKb())
+            .key("cached").value(cached);
+        writeSizes(json);
+        json.key("phases").beginArray();
+        for (const PhaseRecord& phase : phases) {
+            json.beginObject().key("name").value(phase.name).key("start_ms").value(phase.startMicros * 1e-3);
+            writeCosts(json, phase, 1e-3, "_ms");
+            json.endObject();
+        }
+        json.endArray().endObject();
+    }
+
+    // One complete ("X") event per phase on a single thread track, inside
+    // an event for the whole compilation; timestamps are microseconds
+    void writeTrace(ostream& out) const {
+        JsonWriter json(out);
+        json.beginObject().key("traceEvents").beginArray();
+        json.beginObject().key("name").value("compile").key("cat").value("mukku").key("ph").value("X")
+            .key("ts").value(0.0).key("dur").value(total.wallMicros).key("pid").value(1).key("tid").value(1)
+            .key("args").beginObject();
+        writeCosts(json, total, 1, "_us");
+        json.key("peak_rss_kb").value(peakRssKb()).key("cached").value(cached);
+        writeSizes(json);
+        json.endObject().endObject();
+        for (const PhaseRecord& phase : phases) {
+            json.beginObject().key("name").value(phase.name).key("cat").value("phase").key("ph").value("X")
+                .key("ts").value(phase.startMicros).key("dur").value(phase.wallMicros)
+                .key("pid").value(1).key("tid").value(1)
+                .key("args").beginObject();
+            writeCosts(json, phase, 1, "_us");
+            json.endObject().endObject();
+        }
+        json.endArray().key("displayTimeUnit").value("ms").endObject();
+        out << '\n';
+    }
+
+private:
+    chrono::steady_clock::time_point began = chrono::steady_clock::now();
+    double beganCpu = 0;
+    AllocCounters beganAllocs;
+
+    static double micros(chrono::steady_clock::time_point from, chrono::steady_clock::time_point to) {
+        return chrono::duration<double, micro>(to - from).count();
+    }
+
+    // High-water mark of the whole process, not just this compilation
+    static long long peakRssKb() {
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss;
+    }
+
+    static void writeCosts(JsonWriter& json, const PhaseRecord& phase, double scale, const string& unit) {
+        json.key("wall" + unit).value(phase.wallMicros * scale)
+            .key("cpu" + unit).value(phase.cpuMicros * scale)
+            .key("allocations").value((long long)phase.allocations)
+            .key("allocated_bytes").value((long long)phase.allocatedBytes);
+    }
+
+    void writeSizes(JsonWriter& json) const {
+        json.key("tokens").value((long long)tokens)
+            .key("ast_nodes").value((long long)astNodes)
+            .key("symbols").value((long long)symbols)
+            .key("tac_instructions").value((long long)tacInstructions)
+            .key("optimized_instructions").value((long long)optimizedInstructions)
+            .key("machine_instructions").value((long long)machineInstructions)
+            .key("storage_slots").value((long long)storageSlots)
+            .key("vm_instructions").value((long long)vmInstructions);
+    }
+};
+
+// Recursive-descent parser over a token array. Nodes go to 'ast' and
+// diagnostics to 'errors'. After an error the parser skips to a point
+// where a statement can start and goes on, so one parse reports every
+// syntax error and the tree holds everything that did parse. Tokens are
+// only read, so parsers with arenas of their own can work on different
+// parts of one array at the same time.
+class Parser {
+public:
+    // A top-level statement and the tokens its parse examined: from
+    // firstToken up to and including endToken, the first one not consumed.
+    // Its parse errors are errors[errorBegin, errorBegin + errorCount).
+    struct StatementSpan {
+        uint32_t firstToken;
+        uint32_t endToken;
+        NodeId node;
+        uint32_t errorBegin;
+        uint32_t errorCount;
+    };
+
+    Parser(const vector<Token>& toks, string_view src, AST& tree, vector<Diagnostic>& errs)
+        : tokens(toks), source(src), ast(tree), errors(errs) {}
+
+    size_t position() const { return currentTokenIndex; }
+    void seek(size_t index) { currentTokenIndex = index; }
+    bool atEnd() const { return currentToken().type == TokenType::END; }
+
+    // Parses the top-level statement at the current token and records its
+    // span. A statement's parse depends on nothing but where it starts.
+    NodeId parseTopLevel(vector<StatementSpan>& spans) {
+        uint32_t first = currentTokenIndex;
+        uint32_t errorBegin = errors.size();
+        NodeId stmt = parseStatement();
+        spans.push_back({first, (uint32_t)currentTokenIndex, stmt, errorBegin,
+                         (uint32_t)(errors.size() - errorBegin)});
+        return stmt;
+    }
+
+private:
+    const vector<Token>& tokens;
+    string_view source;
+    AST& ast;
+    vector<Diagnostic>& errors;
+    size_t currentTokenIndex = 0;
+    vector<NodeId> childScratch;      // pending children of the nodes being parsed
+    // An agar statement whose agar or nhi-to block is being parsed
+    struct OpenIf {
+        NodeId condition;             // NO_NODE if the condition did not parse
+        NodeId ifBlock;               // NO_NODE until the agar block is closed
+        size_t mark;                  // where the open block's children start in childScratch
+    };
+    vector<OpenIf> openIfs;
+    // --- Reserved keywords set for identifier check ---
+    static inline const std::set<std::string_view> reservedKeywords = {"val", "prt", "agar", "nhi-to", "bhejo"};
+
+    NodeId parseStatement() {
+        if (currentToken().type == TokenType::VAL) {
+            return parseDeclaration();
+        } else if (currentToken().type == TokenType::PRT) {
+            return parsePrint();
+        } else if (currentToken().type == TokenType::AGAR) {
+            return parseIfElse();
+        } else if (currentToken().type == TokenType::BHEJO) {
+            return parseReturn();
+        } else {
+            error("Unexpected statement or keyword '" + string(text(currentToken())) + "'");
+            advance();
+            synchronize();
+            return NO_NODE;
+        }
+    }
+
+    // Reports an error at the current token; the compiler fills in its
+    // line and column after parsing
+    void error(string message) {
+        const Token& token = currentToken();
+        errors.push_back({"syntax", move(message), token.offset, token.length, 0, 0});
+    }
+
+    // Panic-mode recovery: skips past the next ';', or up to the next '}'
+    // or statement keyword, whichever comes first
+    void synchronize() {
+        for (;;) {
+            switch (currentToken().type) {
+                case TokenType::SEMI:
+                    advance();
+                    return;
+                case TokenType::RBRACE:
+                case TokenType::END:
+                case TokenType::VAL:
+                case TokenType::PRT:
+                case TokenType::AGAR:
+                case TokenType::BHEJO:
+                    return;
+                default:
+                    advance();
+            }
+        }
+    }
+
+    // Builds a node whose children are the scratch entries pushed since 'mark'
+    NodeId finishNode(NodeId node, size_t mark) {
+        ast.setChildren(node, childScratch.data() + mark, childScratch.size() - mark);
+        childScratch.resize(mark);
+        return node;
+    }
+
+    NodeId makeNode(NodeKind kind, initializer_list<NodeId> kids, string_view value = "", int symbol = -1) {
+        NodeId node = ast.make(kind, value, symbol);
+        ast.setChildren(node, kids.begin(), kids.size());
+        return node;
+    }
+    
+    NodeId parseReturn() {
+        advance(); // skip 'bhejo'
+        NodeId expr = parseExpression();
+        if (expr == NO_NODE) {
+            error("Invalid expression in bhejo statement");
+            synchronize();
+            return NO_NODE;
+        }
+        if (currentToken().type != TokenType::SEMI) {
+            error("Expected ';' after bhejo statement");
+            synchronize();
+        } else {
+            advance(); // skip ';'
+        }
+        return makeNode(NodeKind::Return, {expr});
+    }
+    
+    NodeId parsePrint() {
+        advance(); // skip 'prt'
+        if (currentToken().type != TokenType::LPAREN) {
+            error("Expected '(' after 'prt'");
+            synchronize();
+            return NO_NODE;
+        }
+        advance(); // skip '('
+    
+        NodeId expr = NO_NODE;
+        if (currentToken().type == TokenType::STRING) {
+            expr = ast.make(NodeKind::StringLiteral, text(currentToken()));
+            advance();
+        } else {
+            expr = parseExpression();
+        }
+    
+        if (currentToken().type != TokenType::RPAREN) {
+            error("Expected ')' after prt argument");
+            synchronize();
+            return NO_NODE;
+        }
+        advance(); // skip ')'
+    
+        if (currentToken().type != TokenType::SEMI) {
+            error("Expected ';' after prt statement");
+            synchronize();
+        } else {
+            advance(); // skip ';'
+        }
+    
+        if (expr == NO_NODE) return makeNode(NodeKind::Print, {});
+        return makeNode(NodeKind::Print, {expr});
+    }
+
+    // Reads 'agar (condition) {' and opens the agar block. If the header
+    // is malformed but a '{' ends it, the block is opened without a
+    // condition so its statements are still parsed.
+    bool openIf() {
+        advance(); // skip 'agar'
+        NodeId condition = NO_NODE;
+        if (currentToken().type != TokenType::LPAREN) {
+            error("Expected '(' after 'agar'");
+        } else {
+            advance(); // skip '('
+            condition = parseExpression();
+            if (condition == NO_NODE) {
+                error("Invalid condition in agar statement");
+            } else if (currentToken().type != TokenType::RPAREN) {
+                error("Expected ')' after agar condition");
+                condition = NO_NODE;
+            } else {
+                advance(); // skip ')'
+                if (currentToken().type != TokenType::LBRACE) {
+                    error("Expected '{' after agar condition");
+                    synchronize();
+                    return false;
+                }
+            }
+        }
+        if (condition == NO_NODE) {
+            while (currentToken().type != TokenType::LBRACE) {
+                TokenType type = currentToken().type;
+                if (type == TokenType::SEMI || type == TokenType::RBRACE || type == TokenType::END) {
+                    synchronize();
+                    return false;
+                }
+                advance();
+            }
+        }
+        advance(); // skip '{'
+        openIfs.push_back({condition, NO_NODE, childScratch.size()});
+        return true;
+    }
+
+    // The statement an agar with these blocks stands for. Without a
+    // condition its blocks are kept in a plain block, so semantic
+    // analysis still sees their contents.
+    NodeId makeIf(NodeId condition, NodeId ifBlock, NodeId elseBlock) {
+        if (condition == NO_NODE) {
+            return elseBlock == NO_NODE ? ifBlock : makeNode(NodeKind::Block, {ifBlock, elseBlock});
+        }
+        if (elseBlock == NO_NODE) return makeNode(NodeKind::IfElse, {condition, ifBlock});
+        return makeNode(NodeKind::IfElse, {condition, ifBlock, elseBlock});
+    }
+
+    // Parses an agar statement and every agar nested in it. The agars
+    // whose blocks are still open live on 'openIfs' instead of the call
+    // stack, so nesting depth is limited only by memory.
+    NodeId parseIfElse() {
+        size_t base = openIfs.size();
+        if (!openIf()) return NO_NODE;
+        for (;;) {
+            TokenType type = currentToken().type;
+            if (type == TokenType::AGAR) {
+                openIf();
+                continue;
+            }
+            if (type != TokenType::RBRACE && type != TokenType::END) {
+                NodeId stmt = parseStatement();
+                if (stmt != NO_NODE) childScratch.push_back(stmt);
+                continue;
+            }
+
+            // The innermost open block has ended; one the input ends in
+            // is closed anyway
+            OpenIf& open = openIfs.back();
+            NodeId block = finishNode(ast.make(NodeKind::Block), open.mark);
+            NodeId stmt = NO_NODE;
+            if (open.ifBlock == NO_NODE) {
+                if (type != TokenType::RBRACE) {
+                    error("Expected '}' at end of agar block");
+                } else {
+                    advance(); // skip '}'
+                    if (currentToken().type == TokenType::NHI_TO) {
+                        advance(); // skip 'nhi-to'
+                        if (currentToken().type == TokenType::LBRACE) {
+                            advance(); // skip '{'
+                            open.ifBlock = block;
+                            continue;
+                        }
+                        error("Expected '{' after nhi-to");
+                    }
+                }
+                stmt = makeIf(open.condition, block, NO_NODE);
+            } else {
+                if (type != TokenType::RBRACE) {
+                    error("Expected '}' at end of nhi-to block");
+                } else {
+                    advance(); // skip '}'
+                }
+                stmt = makeIf(open.condition, open.ifBlock, block);
+            }
+
+            openIfs.pop_back();
+            if (openIfs.size() == base) return stmt;
+            if (stmt != NO_NODE) childScratch.push_back(stmt);
+        }
+    }
+    
+
+    NodeId parseDeclaration() {
+        advance(); // skip 'val'
+        // Check if the next token is a keyword
+    if (currentToken().type == TokenType::VAL ||
+    currentToken().type == TokenType::PRT ||
+    currentToken().type == TokenType::AGAR ||
+    currentToken().type == TokenType::NHI_TO ||
+    currentToken().type == TokenType::BHEJO) {
+    error("Cannot use reserved keyword '" + string(text(currentToken())) + "' as an identifier after 'val'");
+    advance(); // the keyword stands for the name, so recovery skips it
+    synchronize();
+    return NO_NODE;
+}
+        if (currentToken().type != TokenType::ID) {
+            error("Expected identifier after 'val'");
+            synchronize();
+            return NO_NODE;
+        }
+        string_view varName = text(currentToken());
+        int varSymbol = currentToken().symbol;
+        if (reservedKeywords.count(varName)) {
+            error("Cannot use reserved keyword '" + string(varName) + "' as an identifier after 'val'");
+            synchronize();
+            return NO_NODE;
+        }
+        advance(); // skip ID
+
+        // Past the name the variable counts as declared even if the rest
+        // fails, so its uses don't report errors of their own
+        NodeId expr = NO_NODE;
+        if (currentToken().type == TokenType::ASSIGN) {
+            advance(); // skip '='
+            expr = parseExpression();
+            if (expr == NO_NODE) {
+                error("Invalid expression in declaration");
+                synchronize();
+                return makeNode(NodeKind::Declaration, {}, varName, varSymbol);
+            }
+        }
+        if (currentToken().type != TokenType::SEMI) {
+            error("Expected ';' at end of declaration");
+            synchronize();
+        } else {
+            advance(); // skip ';'
+        }
+
+        if (expr == NO_NODE) return makeNode(NodeKind::Declaration, {}, varName, varSymbol);
+        return makeNode(NodeKind::Declaration, {expr}, varName, varSymbol);
+    }
+
+    NodeId parseExpression(int minPrec = 0) {
+        NodeId left = parsePrimary();
+        while (true) {
+            string_view op = text(currentToken());
+            int prec = getPrecedence(op);
+            if ((currentToken().type == TokenType::OP || currentToken().type == TokenType::COMPARE) && prec >= minPrec) {
+                advance();
+                NodeId right = parseExpression(prec + 1);
+                if (right == NO_NODE || left == NO_NODE) return NO_NODE;
+                NodeId bin = makeNode(NodeKind::BinaryExpr, {left, right}, op);
+                ast.nodes[bin].op = binaryOp(op);
+                left = bin;
+            } else {
+                break;
+            }
+        }
+        return left;
+    }
+
+    NodeId parsePrimary() {
+        if (currentToken().type == TokenType::ID) {
+            NodeId node = ast.make(NodeKind::Identifier, text(currentToken()), currentToken().symbol);
+            advance();
+            return node;
+        }
+        else if (currentToken().type == TokenType::NUMBER) {
+            NodeId node = ast.make(NodeKind::NumberLiteral, text(currentToken()));
+            advance();
+            return node;
+        }
+        else {
+            error("Expected identifier or number in expression");
+            return NO_NODE;
+        }
+    }
+
+    static BinOp binaryOp(string_view op) {
+        switch (op[0]) {
+            case '+': return BinOp::ADD;
+            case '-': return BinOp::SUB;
+            case '*': return BinOp::MUL;
+            case '/': return BinOp::DIV;
+            case '=': return BinOp::EQ;
+            case '!': return BinOp::NE;
+            case '<': return op.size() > 1 ? BinOp::LE : BinOp::LT;
+            default:  return op.size() > 1 ? BinOp::GE : BinOp::GT;
+        }
+    }
+
+    int getPrecedence(string_view op) {
+        if (op == "==" || op == "!=" || op == "<" || op == ">" || op == "<=" || op == ">=") return 0;
+        if (op == "+" || op == "-") return 1;
+        if (op == "*" || op == "/") return 2;
+        return -1;
+    }
+    
+
+    const Token& currentToken() const { return tokens[currentTokenIndex]; }
+    string_view text(const Token& token) const { return source.substr(token.offset, token.length); }
+    void advance() { if (currentTokenIndex < tokens.size() - 1) ++currentTokenIndex; }
+};
+
+// Fixed-size thread pool with one task deque per worker. A worker pops
+// its own deque from the back and, when that is empty, steals from the
+// front of the others. The destructor drains all queued tasks.
+class WorkStealingPool {
+    struct TaskQueue {
+        mutex lock;
+        deque<function<void()>> tasks;
+    };
+
+    vector<unique_ptr<TaskQueue>> queues;
+    vector<thread> threads;
+    mutex idleLock;
+    condition_variable idle;
+    size_t pending = 0;          // queued tasks, guarded by idleLock
+    bool stopping = false;
+    atomic<size_t> nextQueue{0};
+
+    bool takeFrom(size_t index, bool back, function<void()>& task) {
+        TaskQueue& q = *queues[index];
+        lock_guard<mutex> guard(q.lock);
+        if (q.tasks.empty()) return false;
+        if (back) {
+            task = move(q.tasks.back());
+            q.tasks.pop_back();
+        } else {
+            task = move(q.tasks.front());
+            q.tasks.pop_front();
+        }
+        return true;
+    }
+
+    bool findTask(size_t self, function<void()>& task) {
+        if (takeFrom(self, true, task)) return true;
+        for (size_t i = 1; i < queues.size(); ++i) {
+            if (takeFrom((self + i) % queues.size(), false, task)) return true;
+        }
+        return false;
+    }
+
+    void workerLoop(size_t self) {
+        function<void()> task;
+        while (true) {
+            if (findTask(self, task)) {
+                {
+                    lock_guard<mutex> guard(idleLock);
+                    --pending;
+                }
+                task();
+                task = nullptr;
+                continue;
+            }
+            unique_lock<mutex> guard(idleLock);
+            idle.wait(guard, [this] { return pending > 0 || stopping; });
+            if (stopping && pending == 0) return;
+        }
+    }
+
+public:
+    explicit WorkStealingPool(size_t threadCount) {
+        threadCount = max<size_t>(threadCount, 1);
+        for (size_t i = 0; i < threadCount; ++i) queues.push_back(make_unique<TaskQueue>());
+        for (size_t i = 0; i < threadCount; ++i) threads.emplace_back([this, i] { workerLoop(i); });
+    }
+
+    ~WorkStealingPool() {
+        {
+            lock_guard<mutex> guard(idleLock);
+            stopping = true;
+        }
+        idle.notify_all();
+        for (thread& t : threads) t.join();
+    }
+
+    size_t size() const { return threads.size(); }
+
+    // Tasks are dealt round-robin; idle workers rebalance by stealing
+    void submit(function<void()> task) {
+        TaskQueue& q = *queues[nextQueue++ % queues.size()];
+        {
+            lock_guard<mutex> guard(q.lock);
+            q.tasks.push_back(move(task));
+        }
+        {
+            lock_guard<mutex> guard(idleLock);
+            ++pending;
+        }
+        idle.notify_one();
+    }
+};
+
+// Shared by every compiler in the process. Parse tasks never wait on
+// other tasks, so compilers running on a batch pool can use it as well.
+WorkStealingPool& parsePool() {
+    static WorkStealingPool pool(thread::hardware_concurrency());
+    return pool;
+}
+
+// --- Compilation cache ---
+// Results are content-addressed: the key hashes the compiler build, the
+// options that shape the output and the source text. Compilation has no
+// inputs besides these, so a hit can replay the stored phase listing,
+// program output and exit status verbatim.
+
+// Bump whenever a change alters what any compilation prints, so stored
+// listings from older builds stop matching
+const char* const COMPILER_VERSION = "mukku 25";
+
+static uint64_t mix64(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+// Hashes eight bytes per step; the tail is folded in as one padded word
+uint64_t hashBytes(string_view data, uint64_t seed = 0) {
+    const uint64_t k = 0x9e3779b97f4a7c15ULL;
+    uint64_t h = seed ^ (data.size() * k);
+    size_t i = 0;
+    for (; i + 8 <= data.size(); i += 8) {
+        uint64_t word;
+        memcpy(&word, data.data() + i, 8);
+        h = (h ^ mix64(word)) * k;
+    }
+    if (i < data.size()) {
+        uint64_t word = 0;
+        memcpy(&word, data.data() + i, data.size() - i);
+        h = (h ^ mix64(word)) * k;
+    }
+    return mix64(h);
+}
+
+// The version plus a hash of the running executable, so two different
+// builds never share results even if the version wasn't bumped; build
+// timestamps can't tell them apart under reproducible builds
+const string& compilerBuildId() {
+    static const string id = [] {
+        string build = COMPILER_VERSION;
+        ifstream self("/proc/self/exe", ios::binary);
+        if (self.is_open()) {
+            ostringstream contents;
+            contents << self.rdbuf();
+            char digest[17];
+            snprintf(digest, sizeof(digest), "%016llx", (unsigned long long)hashBytes(contents.str()));
+            build += string(" ") + digest;
+        }
+        return build;
+    }();
+    return id;
+}
+
+// The options that change what a compilation prints
+string cacheTag(const CompileOptions& options) {
+    string tag = compilerBuildId();
+    tag += options.format == OutputFormat::Json ? ";json" : ";text";
+    tag += options.jit ? ";jit" : ";vm";
+    if (options.phases != ALL_PHASES) tag += ";phases=" + to_string(options.phases);
+    // A run that hit the time limit is never stored, so that limit is left out
+    const ExecutionLimits& limits = options.limits;
+    if (limits.instructions || limits.memoryBytes || limits.outputBytes) {
+        tag += ";limits=" + to_string(limits.instructions) + "," + to_string(limits.memoryBytes) + "," +
+               to_string(limits.outputBytes);
+    }
+    return tag;
+}
+
+struct CachedResult {
+    int status = 0;
+    string out, err;
+};
+
+struct CacheCounters {
+    size_t hits = 0;          // served from memory
+    size_t diskHits = 0;      // served from the on-disk store
+    size_t misses = 0;
+    size_t evictions = 0;     // dropped from memory to stay under its cap
+    size_t diskEvictions = 0; // deleted from disk to stay under its cap
+};
+
+struct CacheOptions {
+    size_t memoryLimit = 0;           // bytes; 0 disables the in-memory LRU
+    string directory;                 // empty disables the on-disk store
+    uintmax_t diskLimit = 256u << 20; // bytes
+};
+
+// Applies one cache flag; returns false if 'arg' is not one
+bool parseCacheOption(string_view arg, CacheOptions& options) {
+    if (arg.substr(0, 12) == "--cache-dir=") options.directory = string(arg.substr(12));
+    else if (arg.substr(0, 14) == "--cache-limit=") {
+        uintmax_t megabytes = 0;
+        auto [end, ec] = from_chars(arg.data() + 14, arg.data() + arg.size(), megabytes);
+        if (ec != errc() || end != arg.data() + arg.size()) return false;
+        options.diskLimit = megabytes << 20;
+    }
+    else return false;
+    return true;
+}
+
+// An LRU map in memory in front of an optional directory of entry files.
+// Entries keep their source and tag so a hash collision reads as a miss.
+// Safe to share between the batch driver's threads.
+class CompileCache {
+public:
+    explicit CompileCache(CacheOptions opts) : options(move(opts)) {
+        if (options.directory.empty()) return;
+        error_code ec;
+        filesystem::create_directories(options.directory, ec);
+        if (ec) options.directory.clear();
+        else diskBytes = scanDisk().second;
+    }
+
+    bool enabled() const { return options.memoryLimit > 0 || !options.directory.empty(); }
+
+    bool lookup(const string& tag, string_view source, CachedResult& result) {
+        uint64_t key = hashBytes(source, hashBytes(tag));
+        lock_guard<mutex> guard(lock);
+        auto found = index.find(key);
+        if (found != index.end() && found->second->tag == tag && found->second->source == source) {
+            lru.splice(lru.begin(), lru, found->second);
+            result = found->second->result;
+            ++counters.hits;
+            return true;
+        }
+        if (readDisk(key, tag, source, result)) {
+            remember(key, tag, source, result);
+            ++counters.diskHits;
+            return true;
+        }
+        ++counters.misses;
+        return false;
+    }
+
+    void store(const string& tag, string_view source, const CachedResult& result) {
+        uint64_t key = hashBytes(source, hashBytes(tag));
+        lock_guard<mutex> guard(lock);
+        remember(key, tag, source, result);
+        writeDisk(key, tag, source, result);
+    }
+
+    string statsJson() {
+        lock_guard<mutex> guard(lock);
+        ostringstream out;
+        out << "{\"hits\": " << counters.hits << ", \"disk_hits\": " << counters.diskHits
+            << ", \"misses\": " << counters.misses << ", \"evictions\": " << counters.evictions
+            << ", \"disk_evictions\": " << counters.diskEvictions << ", \"entries\": " << lru.size()
+            << ", \"bytes\": " << memoryBytes << ", \"disk_bytes\": " << diskBytes << "}";
+        return out.str();
+    }
+
+private:
+    struct Entry {
+        uint64_t key;
+        string tag, source;
+        CachedResult result;
+        size_t bytes() const { return tag.size() + source.size() + result.out.size() + result.err.size(); }
+    };
+
+    CacheOptions options;
+    mutex lock;
+    list<Entry> lru;                                     // most recent first
+    unordered_map<uint64_t, list<Entry>::iterator> index;
+    size_t memoryBytes = 0;
+    uintmax_t diskBytes = 0;
+    uint32_t nonce = random_device{}();  // keeps temporaries of processes sharing the directory apart
+    size_t tempCounter = 0;
+    CacheCounters counters;
+
+    void remember(uint64_t key, const string& tag, string_view source, const CachedResult& result) {
+        Entry entry{key, tag, string(source), result};
+        if (entry.bytes() > options.memoryLimit) return;
+        auto found = index.find(key);
+        if (found != index.end()) {
+            memoryBytes -= found->second->bytes();
+            lru.erase(found->second);
+        }
+        memoryBytes += entry.bytes();
+        lru.push_front(move(entry));
+        index[key] = lru.begin();
+        while (memoryBytes > options.memoryLimit) {
+            memoryBytes -= lru.back().bytes();
+            index.erase(lru.back().key);
+            lru.pop_back();
+            ++counters.evictions;
+        }
+    }
+
+    filesystem::path entryPath(uint64_t key) const {
+        char name[24];
+        snprintf(name, sizeof(name), "%016llx.mkc", (unsigned long long)key);
+        return filesystem::path(options.directory) / name;
+    }
+
+    static void putBlob(string& buffer, string_view s) {
+        uint64_t length = s.size();
+        buffer.append((const char*)&length, 8);
+        buffer += s;
+    }
+
+    static bool getBlob(string_view& data, string& s) {
+        uint64_t length;
+        if (data.size() < 8) return false;
+        memcpy(&length, data.data(), 8);
+        data.remove_prefix(8);
+        if (data.size() < length) return false;
+        s.assign(data.substr(0, length));
+        data.remove_prefix(length);
+        return true;
+    }
+
+    bool readDisk(uint64_t key, const string& tag, string_view source, CachedResult& result) {
+        if (options.directory.empty()) return false;
+        filesystem::path path = entryPath(key);
+        ifstream file(path, ios::binary);
+        if (!file) return false;
+        string contents((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+        string_view data = contents;
+        string storedTag, storedSource, status;
+        if (!getBlob(data, storedTag) || !getBlob(data, storedSource) || !getBlob(data, status) ||
+            !getBlob(data, result.out) || !getBlob(data, result.err) || status.size() != sizeof(int)) {
+            return false;
+        }
+        if (storedTag != tag || storedSource != source) return false;
+        memcpy(&result.status, status.data(), sizeof(int));
+        // Reads refresh the timestamp so eviction drops the least recently used
+        error_code ec;
+        filesystem::last_write_time(path, filesystem::file_time_type::clock::now(), ec);
+        return true;
+    }
+
+    // Writes to a private temporary and renames it into place, so
+    // concurrent readers see either no entry or a complete one
+    void writeDisk(uint64_t key, const string& tag, string_view source, const CachedResult& result) {
+        if (options.directory.empty()) return;
+        string buffer, status((const char*)&result.status, sizeof(int));
+        putBlob(buffer, tag);
+        putBlob(buffer, source);
+        putBlob(buffer, status);
+        putBlob(buffer, result.out);
+        putBlob(buffer, result.err);
+        if (buffer.size() > options.diskLimit) return;
+
+        filesystem::path path = entryPath(key);
+        filesystem::path temp = path;
+        temp += ".tmp" + to_string(nonce) + "-" + to_string(++tempCounter);
+        {
+            ofstream file(temp, ios::binary | ios::trunc);
+            if (!file.write(buffer.data(), buffer.size())) {
+                file.close();
+                error_code ec;
+                filesystem::remove(temp, ec);
+                return;
+            }
+        }
+        error_code ec;
+        filesystem::rename(temp, path, ec);
+        if (ec) {
+            filesystem::remove(temp, ec);
+            return;
+        }
+        diskBytes += buffer.size();
+        if (diskBytes > options.diskLimit) evictDisk();
+    }
+
+    // Lists entry files oldest first, with their total size
+    pair<vector<pair<filesystem::file_time_type, filesystem::path>>, uintmax_t> scanDisk() const {
+        vector<pair<filesystem::file_time_type, filesystem::path>> files;
+        uintmax_t total = 0;
+        error_code ec;
+        for (const auto& item : filesystem::directory_iterator(options.directory, ec)) {
+            if (item.path().extension() != ".mkc") continue;
+            error_code itemError;
+            uintmax_t size = item.file_size(itemError);
+            auto time = item.last_write_time(itemError);
+            if (itemError) continue;
+            files.push_back({time, item.path()});
+            total += size;
+        }
+        sort(files.begin(), files.end());
+        return {move(files), total};
+    }
+
+    // Other processes may share the directory, so the running total is
+    // only an estimate; eviction rescans to get the real one
+    void evictDisk() {
+        auto [files, total] = scanDisk();
+        for (const auto& file : files) {
+            if (total <= options.diskLimit) break;
+            error_code ec;
+            uintmax_t size = filesystem::file_size(file.second, ec);
+            if (!ec && filesystem::remove(file.second, ec)) {
+                total -= size;
+                ++counters.diskEvictions;
+            }
+        }
+        diskBytes = total;
+    }
+};
+
+// The bytes of a source file. A regular file is mapped read-only, so
+// even a very large one is never copied onto the heap and its pages stay
+// reclaimable; a pipe, a terminal or "-" (stdin) is read in blocks.
+class SourceFile {
+    const char* mapped = nullptr;
+    size_t mappedSize = 0;
+    string buffer;
+
+#ifdef MUKKU_MMAP
+    // Appends everything left on 'fd' to the buffer
+    bool readAll(int fd) {
+        char block[1 << 16];
+        for (;;) {
+            ssize_t got = ::read(fd, block, sizeof(block));
+            if (got == 0) return true;
+            if (got < 0 && errno != EINTR) return false;
+            if (got > 0) buffer.append(block, got);
+        }
+    }
+#endif
+
+public:
+    SourceFile() = default;
+    SourceFile(const SourceFile&) = delete;
+    SourceFile& operator=(const SourceFile&) = delete;
+    ~SourceFile() { close(); }
+
+    // Returns false if 'path' can't be opened or read
+    bool open(const string& path) {
+        close();
+#ifdef MUKKU_MMAP
+        if (path == "-") return readAll(STDIN_FILENO);
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat info;
+        bool ok = fstat(fd, &info) == 0;
+        if (ok && S_ISREG(info.st_mode) && info.st_size > 0) {
+            void* memory = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (memory != MAP_FAILED) {
+                // The lexer reads it front to back
+                madvise(memory, info.st_size, MADV_SEQUENTIAL);
+                mapped = (const char*)memory;
+                mappedSize = info.st_size;
+            }
+        }
+        if (ok && !mapped) ok = readAll(fd);
+        ::close(fd);
+        return ok;
+#else
+        if (path == "-") {
+            ostringstream contents;
+            contents << cin.rdbuf();
+            buffer = contents.str();
+            return true;
+        }
+        ifstream file(path, ios::binary);
+        if (!file.is_open()) return false;
+        ostringstream contents;
+        contents << file.rdbuf();
+        buffer = contents.str();
+        return true;
+#endif
+    }
+
+    void close() {
+#ifdef MUKKU_MMAP
+        if (mapped) munmap((void*)mapped, mappedSize);
+#endif
+        mapped = nullptr;
+        mappedSize = 0;
+        buffer = string();
+    }
+
+    string_view text() const { return mapped ? string_view(mapped, mappedSize) : string_view(buffer); }
+};
+
+// Compiler class
+class MukkuCompiler {
+private:
+    CompileOptions options;
+    string_view source;             // tokens and AST values are views into this
+    string sourceText;              // owns 'source' unless it comes from 'input'
+    SourceFile input;               // the file compile() read, mapped where possible
+    SymbolInterner interner;
+    vector<Token> tokens;
+    vector<LexError> lexErrors;
+    mutable LineIndex lines;        // built on first use for the current source
+    SymbolTable symbols;
+    vector<int> nodeSlots;          // node ID -> slot of the variable a Declaration or Identifier names
+    vector<Diagnostic> errors;
+    TacProgram intermediateCode;
+    vector<PassStats> optimizationStats;
+    vector<PeepholeStats> peepholeStats;    // one entry per generated function
+    MachineCode machineCode;
+    AST ast;
+    CompileCache* cache = nullptr;
+    mutable CompileStats stats;     // filled in only when a report was asked for
+    chrono::steady_clock::time_point requestStart;   // the time limit counts from here
+    ExecutionLimit exceededLimit = ExecutionLimit::None;   // the limit that stopped the last run
+
+    using StatementSpan = Parser::StatementSpan;
+    vector<StatementSpan> statementSpans;
+    vector<NodeId> programChildren;
+    vector<StatementSpan> spanScratch;
+    vector<Diagnostic> errorScratch;
+    vector<Token> relexScratch;
+    // Arena sizes after the last full build; sessions rebuild once garbage outgrows them
+    size_t builtNodes = 0, builtChildren = 0, builtSymbols = 0;
+public:
+    explicit MukkuCompiler(CompileOptions opts = CompileOptions()) : options(opts) {}
+
+    void setOptions(const CompileOptions& opts) { options = opts; }
+
+    // Results are looked up in and stored to 'c' from then on; may be null
+    void setCache(CompileCache* c) { cache = c; }
+
+    // Phases of the last compilation; empty unless options asked for a report
+    const CompileStats& lastStats() const { return stats; }
+
+    // Returns the process exit status: non-zero for unreadable input or a runtime error
+    // "-" reads stdin
+    int compile(const string& filename, ostream& out = cout, ostream& err = cerr) {
+        sourceText = string();
+        if (!input.open(filename)) {
+            err << "Error: Could not open file '" << filename << "'" << endl;
+            return 1;
+        }
+        return compileText(input.text(), out, err);
+    }
+
+    // Compiles and runs 'code', writing the phase listing to 'out' and
+    // runtime errors to 'err'. Returns the exit status.
+    int compileSource(string code, ostream& out, ostream& err) {
+        input.close();
+        sourceText = move(code);
+        return compileText(sourceText, out, err);
+    }
+
+    // --- Editor sessions ---
+    // A session instance keeps its source, tokens and AST between calls
+    // and brings them up to date from edit deltas.
+    void openSession(string code) {
+        stats.begin(instrumented());
+        interner.setOwning(true);
+        input.close();
+        sourceText = move(code);
+        source = sourceText;
+        buildFrontEnd();
+    }
+
+    // Replaces 'deleted' bytes at 'offset' with 'inserted', re-lexing only
+    // the damaged token window and re-parsing only the top-level
+    // statements that examined it. Returns false for an invalid range
+    // or a result longer than MAX_SOURCE_BYTES.
+    bool applyEdit(size_t offset, size_t deleted, string_view inserted) {
+        stats.begin(instrumented());
+        CompileStats::Scope timed = phase("edit");
+        if (offset > source.size() || deleted > source.size() - offset) return false;
+        if (inserted.size() > MAX_SOURCE_BYTES - (source.size() - deleted)) return false;
+        if (ast.nodes.size() > 2 * builtNodes + 4096 || ast.childIds.size() > 2 * builtChildren + 4096 ||
+            interner.size() > 2 * builtSymbols + 1024) {
+            sourceText.replace(offset, deleted, inserted);
+            source = sourceText;
+            buildFrontEnd();
+            return true;
+        }
+        size_t editEnd = offset + deleted;
+        long long delta = (long long)inserted.size() - (long long)deleted;
+
+        // A token's scan reads one character past its end, and keyword
+        // matching up to six from its start, so re-lexing starts after the
+        // last token that ends more than six characters before the edit.
+        // An unterminated quote read to the end of the file.
+        size_t first = lower_bound(tokens.begin(), tokens.end() - 1, offset, [](const Token& t, size_t at) {
+            return t.offset + t.length + 6 <= at;
+        }) - tokens.begin();
+        for (const LexError& e : lexErrors) {
+            if (first == 0 || e.offset >= tokens[first - 1].offset + tokens[first - 1].length) break;
+            if (source[e.offset] == '"' || e.offset + 2 > offset) {
+                first = upper_bound(tokens.begin(), tokens.begin() + first, e.offset, [](size_t at, const Token& t) {
+                    return at < t.offset;
+                }) - tokens.begin();
+                break;
+            }
+        }
+        size_t pos = first > 0 ? tokens[first - 1].offset + tokens[first - 1].length : 0;
+
+        const char* oldData = source.data();
+        size_t oldSize = source.size();
+        sourceText.replace(offset, deleted, inserted);
+        source = sourceText;
+        lines.clear();
+        rebaseNodeValues((uintptr_t)oldData, oldSize, offset, editEnd, delta);
+
+        // Errors from the restart on are found again up to the sync point
+        size_t errorMark = lower_bound(lexErrors.begin(), lexErrors.end(), pos, [](const LexError& e, size_t at) {
+            return e.offset < at;
+        }) - lexErrors.begin();
+        vector<LexError> laterErrors(lexErrors.begin() + errorMark, lexErrors.end());
+        lexErrors.resize(errorMark);
+
+        // Scan until a new token starts where a shifted old one did; from
+        // there on the old tokens are exact once moved
+        relexScratch.clear();
+        size_t sync = tokens.size();
+        size_t candidate = first;
+        size_t insertedEnd = offset + inserted.size();
+        while (lexToken(relexScratch, pos)) {
+            if (relexScratch.empty() || relexScratch.back().offset < insertedEnd) continue;
+            const Token& t = relexScratch.back();
+            size_t oldStart = t.offset - delta;
+            while (candidate + 1 < tokens.size() && tokens[candidate].offset < oldStart) ++candidate;
+            if (candidate + 1 < tokens.size() && tokens[candidate].offset == oldStart) {
+                sync = candidate;
+                break;
+            }
+        }
+
+        if (sync == tokens.size()) {
+            tokens.erase(tokens.begin() + first, tokens.end());
+            tokens.insert(tokens.end(), relexScratch.begin(), relexScratch.end());
+            tokens.emplace_back(TokenType::END, source.size(), 0);
+        } else {
+            size_t syncOffset = tokens[sync].offset;
+            relexScratch.pop_back();
+            for (size_t i = sync; i < tokens.size(); ++i) tokens[i].offset += delta;
+            for (LexError e : laterErrors) {
+                if (e.offset < syncOffset) continue;
+                e.offset += delta;
+                lexErrors.push_back(e);
+            }
+            // Overwrite in place so at most the shorter side moves the tail
+            size_t common = min(relexScratch.size(), sync - first);
+            copy(relexScratch.begin(), relexScratch.begin() + common, tokens.begin() + first);
+            if (relexScratch.size() > common) {
+                tokens.insert(tokens.begin() + first + common, relexScratch.begin() + common, relexScratch.end());
+            } else {
+                tokens.erase(tokens.begin() + first + common, tokens.begin() + sync);
+            }
+        }
+
+        // Spans index the previous parse's errors, which reparseProgram copies
+        errorScratch.swap(errors);
+        errors.clear();
+        for (const LexError& e : lexErrors) errors.push_back(lexDiagnostic(e));
+        if (ast.root == NO_NODE) {
+            CompileStats::Scope timedParse = phase("parse");
+            ast.clear();
+            ast.root = parseProgram();
+        } else {
+            CompileStats::Scope timedParse = phase("reparse");
+            reparseProgram(first, sync, (long long)relexScratch.size() - (long long)(sync - first));
+        }
+        locateErrors();
+        countFrontEnd();
+        return true;
+    }
+
+    // Compiles the session's current source
+    int compileCurrent(ostream& out, ostream& err) {
+        requestStart = chrono::steady_clock::now();
+        int status = throughCache(out, err, [this](ostream& phaseOut, ostream& phaseErr) {
+            return runPhases(phaseOut, phaseErr);
+        });
+        return reportStats(err) ? status : 1;
+    }
+
+private:
+    // Compiles 'text', which must outlive the compiler's use of it:
+    // sourceText, or the file in 'input'
+    int compileText(string_view text, ostream& out, ostream& err) {
+        if (text.size() > MAX_SOURCE_BYTES) {
+            err << "Error: Source too large (" << text.size() << " bytes, at most " << MAX_SOURCE_BYTES
+                << " are supported)" << endl;
+            return 1;
+        }
+        stats.begin(instrumented());
+        requestStart = chrono::steady_clock::now();
+        source = text;
+        int status = throughCache(out, err, [this](ostream& phaseOut, ostream& phaseErr) {
+            buildFrontEnd();
+            return runPhases(phaseOut, phaseErr);
+        });
+        return reportStats(err) ? status : 1;
+    }
+
+    // Runs 'compile' unless the cache already holds the result for 'source'
+    template <typename Compile>
+    int throughCache(ostream& out, ostream& err, Compile compile) {
+        // Writing an object file is a side effect a cached result can't replay
+        if (!cache || !options.objectPath.empty()) return compile(out, err);
+
+        string tag = cacheTag(options);
+        CachedResult result;
+        {
+            CompileStats::Scope timed = phase("cache-lookup");
+            stats.cached = cache->lookup(tag, source, result);
+        }
+        if (!stats.cached) {
+            ostringstream phaseOut, phaseErr;
+            exceededLimit = ExecutionLimit::None;
+            result.status = compile(phaseOut, phaseErr);
+            result.out = phaseOut.str();
+            result.err = phaseErr.str();
+            // Whether a run beats the clock depends on the load, not the source
+            if (exceededLimit != ExecutionLimit::Time) {
+                CompileStats::Scope timed = phase("cache-store");
+                cache->store(tag, source, result);
+            }
+        }
+        out << result.out;
+        err << result.err;
+        return result.status;
+    }
+
+    bool instrumented() const { return options.stats || !options.tracePath.empty(); }
+
+    // Times the enclosing scope as phase 'name' when a report was asked for
+    CompileStats::Scope phase(const char* name) const {
+        return CompileStats::Scope(instrumented() ? &stats : nullptr, name);
+    }
+
+    void countFrontEnd() {
+        stats.tokens = tokens.size();
+        stats.astNodes = ast.nodes.size();
+        stats.symbols = interner.size();
+    }
+
+    // Writes the reports asked for; false if the trace file can't be written
+    bool reportStats(ostream& err) {
+        if (!instrumented()) return true;
+        stats.finish();
+        if (options.stats) {
+            stats.writeJson(err);
+            err << '\n';
+        }
+        if (options.tracePath.empty()) return true;
+        ofstream trace(options.tracePath);
+        if (trace) stats.writeTrace(trace);
+        if (trace) return true;
+        err << "Error: Could not write trace file '" << options.tracePath << "'" << endl;
+        return false;
+    }
+
+    // Lexes and parses 'source' from scratch. The scanner skips illegal
+    // characters, so the tokens it did find are parsed either way.
+    void buildFrontEnd() {
+        interner.clear();
+        tokens.clear();
+        lexErrors.clear();
+        lines.clear();
+        errors.clear();
+        ast.clear();
+        statementSpans.clear();
+
+        {
+            CompileStats::Scope timed = phase("lex");
+            tokenize(source);
+        }
+        for (const LexError& e : lexErrors) errors.push_back(lexDiagnostic(e));
+        {
+            CompileStats::Scope timed = phase("parse");
+            ast.root = parseProgram();
+        }
+        locateErrors();
+        countFrontEnd();
+        builtNodes = ast.nodes.size();
+        builtChildren = ast.childIds.size();
+        builtSymbols = interner.size();
+    }
+
+    // Node values view the source; after an edit they are moved into the
+    // new buffer. Values inside the edited range belong to statements
+    // that are about to be re-parsed and are dropped.
+    void rebaseNodeValues(uintptr_t oldData, size_t oldSize, size_t offset, size_t editEnd, long long delta) {
+        const char* data = source.data();
+        bool bufferMoved = (uintptr_t)data != oldData;
+        for (ASTNode& node : ast.nodes) {
+            if (node.value.empty()) continue;
+            uintptr_t at = (uintptr_t)node.value.data();
+            if (at < oldData || at >= oldData + oldSize) continue;
+            size_t start = at - oldData;
+            if (start + node.value.size() <= offset) {
+                if (bufferMoved) node.value = string_view(data + start, node.value.size());
+            } else if (start >= editEnd) {
+                node.value = string_view(data + start + delta, node.value.size());
+            } else {
+                node.value = string_view();
+            }
+        }
+    }
+
+    bool lists(Phase phase) const { return options.lists(phase); }
+
+    // The phases a compilation runs: those whose listings were asked for
+    // and what they depend on. The lexer and parser always run, for
+    // their errors.
+    struct PhasePlan {
+        bool semantic, tac, optimize, codegen;
+    };
+
+    PhasePlan plan() const {
+        PhasePlan plan;
+        plan.codegen = lists(Phase::Assembly) || !options.objectPath.empty();
+        plan.optimize = plan.codegen || lists(Phase::Optimized);
+        plan.tac = plan.optimize || lists(Phase::Tac);
+        // The VM runs the checked tree, so a run alone needs nothing more
+        plan.semantic = plan.tac || lists(Phase::Symbols) || lists(Phase::Run);
+        return plan;
+    }
+
+    // Writes the phase listing for the front end already built over
+    // 'source', with only the parts options.phases asks for
+    int runPhases(ostream& out, ostream& err) {
+        symbols.reset(interner);
+        intermediateCode = TacProgram();
+        optimizationStats.clear();
+        peepholeStats.clear();
+        machineCode = MachineCode();
+        if (options.format == OutputFormat::Json) return compileToJson(out, err);
+        PhasePlan run = plan();
+
+        if (lists(Phase::Source)) {
+            out << "=== Source Code ===\n";
+            out << source << "\n\n";
+        }
+
+        // Errors don't stop the front end: each phase lists its own and
+        // the program is compiled only if there are none. A phase with
+        // neither errors nor a listing asked for gets no heading.
+        // Phase 1: Lexical Analysis
+        size_t lexEnd = lexErrors.size();
+        if (lists(Phase::Tokens) || lexEnd > 0) {
+            out << "=== Lexical Analysis (Tokenization) ===\n";
+            if (lists(Phase::Tokens)) printTokens(out);
+            printErrors(out, 0, lexEnd);
+        }
+
+        // Phase 2: Syntax Analysis
+        size_t parseEnd = errors.size();
+        if (lists(Phase::Ast) || parseEnd > lexEnd) {
+            out << "\n=== Syntax Analysis (Parsing) ===\n";
+            if (parseEnd > lexEnd) {
+                printErrors(out, lexEnd, parseEnd);
+            } else if (lexEnd == 0 && lists(Phase::Ast)) {
+                // === JSON Parse Tree Output ===
+                out << "\nParse Tree (JSON):\n";
+                CompileStats::Scope timed = phase("listing");
+                ast.printJSON(out, ast.root, 0);
+                out << '\n';
+            }
+        }
+
+        // Phase 3: Semantic Analysis, on whatever parsed
+        if (!run.semantic) return 0;
+        analyze();
+        if (lists(Phase::Symbols) || errors.size() > parseEnd) {
+            out << "\n=== Semantic Analysis ===\n";
+            printErrors(out, parseEnd, errors.size());
+        }
+        if (!errors.empty()) return 0;
+
+        if (lists(Phase::Symbols)) {
+            out << "\nSymbol Table:\n";
+            for (int slot : declaredSymbols()) {
+                out << symbols.label(slot) << ": " << SymbolTable::kindName(symbols[slot].kind) << '\n';
+            }
+        }
+
+        // Phase 4: Intermediate Code Generation
+        if (run.tac) generateIntermediateCode();
+        if (lists(Phase::Tac)) {
+            out << "\n=== Intermediate Code Generation ===\n";
+            out << "\nIntermediate Code (Three-Address Code):\n";
+            printTac(out);
+        }
+
+        // Phase 5: Code Optimization
+        if (run.optimize) optimize();
+        if (lists(Phase::Optimized)) {
+            out << "\n=== Code Optimization ===\n";
+            out << "\nOptimized Three-Address Code:\n";
+            printTac(out);
+
+            out << "\nOptimization Passes:\n";
+            for (const PassStats& pass : optimizationStats) {
+                char millis[32];
+                snprintf(millis, sizeof(millis), "%.3f", pass.millis);
+                out << pass.name << ": " << pass.before << " -> " << pass.after << " instructions ("
+                    << pass.before - pass.after << " removed), " << millis << " ms\n";
+            }
+        }
+
+        // Phase 6: Assembly Code Generation
+        if (run.codegen) generateMachineCode();
+        if (lists(Phase::Assembly)) {
+            out << "\n=== Assembly Code Generation ===\n";
+            out << "\nAssembly Code:\n";
+            printAssembly(out);
+
+            out << "\nPeephole Optimization:\n";
+            for (const PeepholeStats& function : peepholeStats) {
+                out << function.function << ": " << function.before << " -> " << function.after << " instructions ("
+                    << function.removed << " removed";
+                if (function.added) out << ", " << function.added << " added";
+                out << ")\n";
+            }
+        }
+        if (!writeObjectFile(err)) return 1;
+
+        out << "\nCompilation successful!\n";
+        if (!lists(Phase::Run)) return 0;
+        out << "\n=== Output of Input Code ===\n";
+        string runtimeError;
+        if (!runProgram(out, runtimeError)) {
+            out.flush();
+            err << "Runtime error: " << runtimeError << endl;
+            return exceededLimit == ExecutionLimit::None ? 1 : LIMIT_EXCEEDED_STATUS;
+        }
+        return 0;
+    }
+
+    // Same phases as the text listing, written as a single JSON document
+    // with one member per completed phase that was asked for, followed by
+    // "errors" and "diagnostics", the same errors with their phase and
+    // source range.
+    int compileToJson(ostream& out, ostream& err) {
+        JsonWriter json(out);
+        PhasePlan run = plan();
+        int status = 0;
+        json.beginObject();
+        if (lists(Phase::Source)) json.key("source").value(source);
+
+        if (lists(Phase::Tokens)) writeTokens(json);
+
+        if (errors.empty() && lists(Phase::Ast)) {
+            CompileStats::Scope timed = phase("listing");
+            json.key("ast");
+            ast.writeJSON(json, ast.root);
+        }
+        if (run.semantic) analyze();
+        if (errors.empty() && run.semantic) {
+            if (lists(Phase::Symbols)) {
+                json.key("symbols").beginArray();
+                for (int slot : declaredSymbols()) {
+                    auto [line, column] = locate(symbols[slot].offset);
+                    json.beginObject()
+                        .key("name").value(symbols.name(slot))
+                        .key("kind").value(SymbolTable::kindName(symbols[slot].kind))
+                        .key("slot").value(slot)
+                        .key("line").value(line)
+                        .key("column").value(column)
+                        .endObject();
+                }
+                json.endArray();
+            }
+
+            if (run.tac) generateIntermediateCode();
+            if (lists(Phase::Tac)) writeTac(json, "tac");
+
+            if (run.optimize) optimize();
+            if (lists(Phase::Optimized)) {
+                writeTac(json, "optimizedTac");
+                json.key("passes").beginArray();
+                for (const PassStats& pass : optimizationStats) {
+                    json.beginObject()
+                        .key("name").value(pass.name)
+                        .key("before").value((long long)pass.before)
+                        .key("after").value((long long)pass.after)
+                        .key("removed").value((long long)(pass.before - pass.after))
+                        .key("millis").value(pass.millis)
+                        .endObject();
+                }
+                json.endArray();
+            }
+
+            if (run.codegen) generateMachineCode();
+            if (lists(Phase::Assembly)) {
+                writeAssembly(json);
+                json.key("peephole").beginArray();
+                for (const PeepholeStats& function : peepholeStats) {
+                    json.beginObject()
+                        .key("function").value(function.function)
+                        .key("before").value((long long)function.before)
+                        .key("after").value((long long)function.after)
+                        .key("removed").value((long long)function.removed)
+                        .key("added").value((long long)function.added)
+                        .endObject();
+                }
+                json.endArray();
+            }
+            if (!writeObjectFile(err)) status = 1;
+
+            if (lists(Phase::Run)) {
+                ostringstream programOutput;
+                string runtimeError;
+                bool ok = runProgram(programOutput, runtimeError);
+                json.key("output").value(programOutput.str());
+                if (!ok) {
+                    json.key("runtimeError").value(runtimeError);
+                    err << "Runtime error: " << runtimeError << '\n';
+                    status = 1;
+                }
+                if (exceededLimit != ExecutionLimit::None) {
+                    json.key("limitExceeded").value(executionLimitName(exceededLimit));
+                    status = LIMIT_EXCEEDED_STATUS;
+                }
+            }
+        }
+
+        json.key("errors").beginArray();
+        for (const Diagnostic& error : errors) json.value(error.format());
+        json.endArray();
+        json.key("diagnostics").beginArray();
+        for (const Diagnostic& error : errors) {
+            json.beginObject()
+                .key("phase").value(error.phase)
+                .key("message").value(error.message)
+                .key("line").value(error.line)
+                .key("column").value(error.column)
+                .key("offset").value((long long)error.offset)
+                .key("length").value((long long)error.length)
+                .endObject();
+        }
+        json.endArray();
+        json.key("success").value(errors.empty() && status == 0);
+        json.endObject();
+        out << '\n';
+        return status;
+    }
+
+    void analyze() {
+        CompileStats::Scope timed = phase("semantic");
+        semanticAnalysis(ast.root);
+    }
+
+    void generateIntermediateCode() {
+        CompileStats::Scope timed = phase("tac");
+        intermediateCode.symbols = &symbols;
+        TacBuilder(ast, nodeSlots, intermediateCode).build(ast.root);
+        stats.tacInstructions = intermediateCode.code.size();
+    }
+
+    void optimize() {
+        CompileStats::Scope timed = phase("optimize");
+        optimizationStats = TacPassManager::standard().run(intermediateCode);
+        stats.optimizedInstructions = intermediateCode.code.size();
+    }
+
+    void generateMachineCode() {
+        {
+            CompileStats::Scope timed = phase("codegen");
+            machineCode = MachineCode();
+            X86CodeGenerator(intermediateCode, machineCode).generate();
+            stats.storageSlots = symbols.size() + intermediateCode.counter;
+        }
+        CompileStats::Scope timed = phase("peephole");
+        peepholeStats = {peepholeOptimize(machineCode)};
+        stats.machineInstructions = machineCode.code.size();
+    }
+
+    // Runs the program natively when machine code was generated, else on
+    // the VM, within options.limits. Native code can't be stopped part way, so under an
+    // instruction or memory limit it runs only if the bytecode shows the
+    // VM would stay within it: bytecode only jumps forward, so a run
+    // dispatches each instruction at most once. Native code also runs to
+    // its end past the output limit, with the excess discarded.
+    bool runProgram(ostream& out, string& runtimeError) {
+        CompileStats::Scope timed = phase("run");
+        const ExecutionLimits& limits = options.limits;
+        exceededLimit = ExecutionLimit::None;
+        CappedStreambuf capped(out.rdbuf(), limits.outputBytes);
+        ostream cappedOut(&capped);
+        ostream& programOut = limits.outputBytes ? cappedOut : out;
+        auto deadline = chrono::steady_clock::time_point::max();
+        if (limits.timeMillis) deadline = requestStart + chrono::milliseconds(limits.timeMillis);
+
+        Bytecode bytecode;
+        bool compiled = !options.jit || machineCode.code.empty() || limits.instructions || limits.memoryBytes;
+        if (compiled) BytecodeCompiler(ast, nodeSlots, bytecode).compile(ast.root, symbols.size());
+        if (limits.memoryBytes && bytecode.registerCount() * sizeof(int) > limits.memoryBytes) {
+            exceededLimit = ExecutionLimit::Memory;
+            runtimeError = "memory limit of " + to_string(limits.memoryBytes) + " bytes exceeded";
+            return false;
+        }
+#ifdef MUKKU_JIT
+        bool finished;
+        bool fits = !limits.instructions || bytecode.code.size() <= limits.instructions;
+        bool inTime = !limits.timeMillis || chrono::steady_clock::now() < deadline;
+        bool native = options.jit && !machineCode.code.empty();
+        if (native && fits && inTime && runJit(machineCode, programOut, finished, runtimeError)) {
+            if (!capped.exceeded()) return finished;
+            exceededLimit = ExecutionLimit::Output;
+            runtimeError = "output limit of " + to_string(limits.outputBytes) + " bytes exceeded";
+            return false;
+        }
+#endif
+        if (!compiled) BytecodeCompiler(ast, nodeSlots, bytecode).compile(ast.root, symbols.size());
+        VM vm(bytecode);
+        bool ok = vm.run(programOut, limits, deadline);
+        runtimeError = vm.runtimeError;
+        exceededLimit = vm.exceeded;
+        stats.vmInstructions = vm.executed;
+        return ok;
+    }
+
+    bool writeObjectFile(ostream& err) {
+        if (options.objectPath.empty()) return true;
+        CompileStats::Scope timed = phase("emit-object");
+        string error;
+        if (writeElfObject(X86Encoder().assemble(machineCode, nullptr), options.objectPath, error)) return true;
+        err << "Error: " << error << endl;
+        return false;
+    }
+
+    void printTac(ostream& out) const {
+        CompileStats::Scope timed = phase("listing");
+        for (size_t i = 0; i < intermediateCode.code.size(); ++i) {
+            out << i << ": " << intermediateCode.format(intermediateCode.code[i]) << '\n';
+        }
+    }
+
+    void writeTac(JsonWriter& json, const char* key) const {
+        CompileStats::Scope timed = phase("listing");
+        json.key(key).beginArray();
+        for (const TacInstr& ins : intermediateCode.code) json.value(intermediateCode.format(ins));
+        json.endArray();
+    }
+
+    void printAssembly(ostream& out) const {
+        CompileStats::Scope timed = phase("listing");
+        for (size_t i = 0; i < machineCode.code.size(); ++i) {
+            out << i << ": " << machineCode.format(machineCode.code[i]) << '\n';
+        }
+        for (size_t i = 0; i < machineCode.data.size(); ++i) {
+            out << machineCode.code.size() + i << ": " << machineCode.formatData(i) << '\n';
+        }
+    }
+
+    void writeAssembly(JsonWriter& json) const {
+        CompileStats::Scope timed = phase("listing");
+        json.key("assembly").beginArray();
+        for (const MInstr& ins : machineCode.code) json.value(machineCode.format(ins));
+        for (size_t i = 0; i < machineCode.data.size(); ++i) json.value(machineCode.formatData(i));
+        json.endArray();
+    }
+
+    // Slots in name order, then declaration order, as the symbol table is listed
+    vector<int> declaredSymbols() const {
+        vector<int> declared(symbols.size());
+        iota(declared.begin(), declared.end(), 0);
+        stable_sort(declared.begin(), declared.end(), [this](int a, int b) {
+            return symbols.name(a) < symbols.name(b);
+        });
+        return declared;
+    }
+
+    // Line and column of source offset 'offset'. The end of the source is
+    // column 0 of the last line, where END has always been listed.
+    pair<int, int> locate(uint32_t offset) const {
+        if (lines.empty()) lines.build(source);
+        auto [line, column] = lines.locate(offset);
+        return {line, offset < source.size() ? column : 0};
+    }
+
+    // Fills in the position of errors the parser reported by offset only
+    void locateErrors() {
+        for (Diagnostic& error : errors) {
+            if (error.line == 0) tie(error.line, error.column) = locate(error.offset);
+        }
+    }
+
+public:
+    // Drops all per-compilation state so the instance can serve another
+    // request. Buffers keep their capacity.
+    void reset() {
+        source = string_view();
+        sourceText.clear();
+        input.close();
+        interner.clear();
+        tokens.clear();
+        lexErrors.clear();
+        lines.clear();
+        statementSpans.clear();
+        symbols.clear();
+        errors.clear();
+        intermediateCode = TacProgram();
+        optimizationStats.clear();
+        peepholeStats.clear();
+        machineCode = MachineCode();
+        ast.clear();
+    }
+
+
+private:
+    // Character classes for the scanner's start-state dispatch
+    enum CharClass : unsigned char { CC_OTHER, CC_DIGIT, CC_IDSTART };
+
+    static const unsigned char* charClasses() {
+        // Function-local static so concurrent compilers initialize it once
+        static const array<unsigned char, 256> table = [] {
+            array<unsigned char, 256> t{};
+            for (int c = 0; c < 256; ++c) {
+                if (c >= '0' && c <= '9') t[c] = CC_DIGIT;
+                else if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_') t[c] = CC_IDSTART;
+            }
+            return t;
+        }();
+        return table.data();
+    }
+
+    // Hand-written DFA scanner. Keywords are matched as prefixes before
+    // identifiers, exactly like the ordered pattern list it replaces
+    // ("valx" lexes as 'val' followed by 'x').
+    void tokenize(string_view source) {
+        size_t pos = 0;
+        tokens.reserve(source.size() / 4 + 1);
+        while (lexToken(tokens, pos)) {}
+        tokens.emplace_back(TokenType::END, source.size(), 0);
+    }
+
+    // Scans the token at or after 'pos' into 'out', or records an illegal
+    // character in lexErrors. Returns false once only whitespace is left.
+    bool lexToken(vector<Token>& out, size_t& pos) {
+        static const pair<string_view, TokenType> keywords[] = {
+            {"val", TokenType::VAL},
+            {"prt", TokenType::PRT},
+            {"agar", TokenType::AGAR},
+            {"nhi-to", TokenType::NHI_TO},
+            {"bhejo", TokenType::BHEJO},
+        };
+        const unsigned char* cls = charClasses();
+        const char* src = source.data();
+        size_t len = source.size();
+
+        pos = scanRun<SpaceChars>(src + pos, src + len) - src;
+        if (pos >= len) return false;
+
+        size_t start = pos;
+        TokenType type = TokenType::END;
+        char c = src[pos];
+        char next = pos + 1 < len ? src[pos + 1] : '\0';
+
+        switch (c) {
+            case '=': type = next == '=' ? TokenType::COMPARE : TokenType::ASSIGN; pos += next == '=' ? 2 : 1; break;
+            case '!': if (next == '=') { type = TokenType::COMPARE; pos += 2; } break;
+            case '<':
+            case '>': type = TokenType::COMPARE; pos += next == '=' ? 2 : 1; break;
+            case '+': case '-': case '*': case '/': type = TokenType::OP; pos++; break;
+            case '(': type = TokenType::LPAREN; pos++; break;
+            case ')': type = TokenType::RPAREN; pos++; break;
+            case '{': type = TokenType::LBRACE; pos++; break;
+            case '}': type = TokenType::RBRACE; pos++; break;
+            case ';': type = TokenType::SEMI; pos++; break;
+            case '"': {
+                const void* close = memchr(src + pos + 1, '"', len - pos - 1);
+                if (close) {
+                    type = TokenType::STRING;
+                    pos = (const char*)close - src + 1;
+                }
+                break;
+            }
+            default:
+                if (cls[(unsigned char)c] == CC_DIGIT) {
+                    type = TokenType::NUMBER;
+                    pos = scanRun<DigitChars>(src + pos, src + len) - src;
+                } else if (cls[(unsigned char)c] == CC_IDSTART) {
+                    for (const auto& kw : keywords) {
+                        if (source.compare(pos, kw.first.size(), kw.first) == 0) {
+                            type = kw.second;
+                            pos += kw.first.size();
+                            break;
+                        }
+                    }
+                    if (type == TokenType::END) {
+                        type = TokenType::ID;
+                        pos = scanRun<IdentChars>(src + pos, src + len) - src;
+                    }
+                }
+        }
+
+        if (type == TokenType::END) {
+            lexErrors.push_back({(uint32_t)start});
+            pos++;
+            return true;
+        }
+        int symbol = type == TokenType::ID ? interner.intern(string_view(source).substr(start, pos - start)) : -1;
+        out.emplace_back(type, start, pos - start, symbol);
+        return true;
+    }
+
+    Diagnostic lexDiagnostic(const LexError& e) const {
+        auto [line, column] = locate(e.offset);
+        return {"lexical", "Illegal character '" + string(1, source[e.offset]) + "'", e.offset, 1, line, column};
+    }
+
+    // A run of top-level statements parsed on the parse pool
+    struct ParseChunk {
+        uint32_t begin = 0, end = 0;
+        AST ast;
+        vector<Diagnostic> errors;
+        vector<StatementSpan> spans;
+    };
+
+    // Chunks are at least this long, so small programs parse on one thread
+    static constexpr size_t MIN_PARSE_CHUNK = 4096;
+
+    // Large programs are split where a pre-scan by ';' and brace depth
+    // sees top-level statements end, and the chunks are parsed in parallel.
+    // A chunk's statements are taken only where the sequential parse
+    // arrives at their start; everything else is parsed here, so the tree,
+    // the errors and their order are exactly those of a sequential parse.
+    NodeId parseProgram() {
+        statementSpans.clear();
+        programChildren.clear();
+        vector<ParseChunk> chunks = parseChunks();
+        vector<NodeId> nodeBase(chunks.size(), NO_NODE);
+        size_t chunk = 0, next = 0;
+
+        Parser parser(tokens, source, ast, errors);
+        while (!parser.atEnd()) {
+            size_t at = parser.position();
+            while (chunk < chunks.size()) {
+                if (next == chunks[chunk].spans.size()) {
+                    ++chunk;
+                    next = 0;
+                } else if (chunks[chunk].spans[next].firstToken < at) {
+                    ++next;
+                } else {
+                    break;
+                }
+            }
+            if (chunk < chunks.size() && chunks[chunk].spans[next].firstToken == at) {
+                ParseChunk& part = chunks[chunk];
+                if (nodeBase[chunk] == NO_NODE) nodeBase[chunk] = ast.append(part.ast);
+                StatementSpan span = part.spans[next++];
+                if (span.node != NO_NODE) span.node += nodeBase[chunk];
+                errors.insert(errors.end(), make_move_iterator(part.errors.begin() + span.errorBegin),
+                              make_move_iterator(part.errors.begin() + span.errorBegin + span.errorCount));
+                span.errorBegin = errors.size() - span.errorCount;
+                statementSpans.push_back(span);
+                if (span.node != NO_NODE) programChildren.push_back(span.node);
+                parser.seek(span.endToken);
+            } else {
+                NodeId stmt = parser.parseTopLevel(statementSpans);
+                if (stmt != NO_NODE) programChildren.push_back(stmt);
+            }
+        }
+        return finishProgram();
+    }
+
+    vector<ParseChunk> parseChunks() {
+        size_t threads = options.parseThreads ? options.parseThreads : thread::hardware_concurrency();
+        size_t count = min(threads * 4, tokens.size() / MIN_PARSE_CHUNK);
+        vector<ParseChunk> chunks;
+        if (threads < 2 || count < 2) return chunks;
+
+        // An agar block goes on into a following nhi-to
+        size_t stride = tokens.size() / count;
+        uint32_t begin = 0;
+        int depth = 0;
+        for (size_t i = 0; i + 1 < tokens.size(); ++i) {
+            TokenType type = tokens[i].type;
+            bool boundary = false;
+            if (type == TokenType::LBRACE) {
+                ++depth;
+            } else if (type == TokenType::RBRACE) {
+                if (depth > 0) --depth;
+                boundary = depth == 0 && tokens[i + 1].type != TokenType::NHI_TO;
+            } else if (type == TokenType::SEMI) {
+                boundary = depth == 0;
+            }
+            if (boundary && i + 1 - begin >= stride) {
+                chunks.emplace_back();
+                chunks.back().begin = begin;
+                chunks.back().end = begin = i + 1;
+            }
+        }
+        if (begin + 1 < tokens.size()) {
+            chunks.emplace_back();
+            chunks.back().begin = begin;
+            chunks.back().end = tokens.size() - 1;
+        }
+
+        mutex doneLock;
+        condition_variable doneSignal;
+        size_t remaining = chunks.size();
+        for (ParseChunk& part : chunks) {
+            parsePool().submit([&] {
+                Parser parser(tokens, source, part.ast, part.errors);
+                parser.seek(part.begin);
+                while (!parser.atEnd() && parser.position() < part.end) parser.parseTopLevel(part.spans);
+                lock_guard<mutex> guard(doneLock);
+                if (--remaining == 0) doneSignal.notify_one();
+            });
+        }
+        unique_lock<mutex> guard(doneLock);
+        doneSignal.wait(guard, [&] { return remaining == 0; });
+        return chunks;
+    }
+
+    NodeId finishProgram() {
+        NodeId program = ast.make(NodeKind::Program);
+        ast.setChildren(program, programChildren.data(), programChildren.size());
+        return program;
+    }
+
+    // Rebuilds Program after the tokens in [damageBegin, damageEnd) were
+    // replaced and later ones moved by 'shift'; the old spans' errors are
+    // in errorScratch. Statements whose examined tokens avoid that window
+    // are reused. Diagnostics carry positions, so a failed statement after
+    // the window is parsed again to place its errors where they now are.
+    void reparseProgram(size_t damageBegin, size_t damageEnd, long long shift) {
+        // Program is built last, so its node and child list end the arena
+        const ASTNode& program = ast[ast.root];
+        if (ast.root + 1 == ast.nodes.size() && program.firstChild + program.childCount == ast.childIds.size()) {
+            ast.childIds.resize(program.firstChild);
+            ast.nodes.pop_back();
+        }
+        spanScratch.swap(statementSpans);
+        statementSpans.clear();
+        auto damaged = [&](const StatementSpan& span) {
+            return span.endToken >= damageBegin && span.firstToken < damageEnd;
+        };
+        auto moved = [&](uint32_t index) -> uint32_t { return index < damageBegin ? index : index + shift; };
+        auto reusable = [&](const StatementSpan& span) {
+            return span.errorCount == 0 || span.endToken < damageBegin;
+        };
+
+        programChildren.clear();
+        Parser parser(tokens, source, ast, errors);
+        size_t next = 0;
+        while (!parser.atEnd()) {
+            size_t at = parser.position();
+            while (next < spanScratch.size() && (damaged(spanScratch[next]) || moved(spanScratch[next].firstToken) < at)) {
+                ++next;
+            }
+            if (next < spanScratch.size() && moved(spanScratch[next].firstToken) == at && reusable(spanScratch[next])) {
+                StatementSpan span = spanScratch[next++];
+                span.firstToken = at;
+                span.endToken = moved(span.endToken);
+                errors.insert(errors.end(), make_move_iterator(errorScratch.begin() + span.errorBegin),
+                              make_move_iterator(errorScratch.begin() + span.errorBegin + span.errorCount));
+                span.errorBegin = errors.size() - span.errorCount;
+                statementSpans.push_back(span);
+                if (span.node != NO_NODE) programChildren.push_back(span.node);
+                parser.seek(span.endToken);
+            } else {
+                NodeId stmt = parser.parseTopLevel(statementSpans);
+                if (stmt != NO_NODE) programChildren.push_back(stmt);
+            }
+        }
+        ast.root = finishProgram();
+    }
+    
+
+    string_view text(const Token& token) const { return string_view(source).substr(token.offset, token.length); }
+
+    void printTokens(ostream& out) const {
+        CompileStats::Scope timed = phase("listing");
+        for (const auto& token : tokens) {
+            auto [line, column] = locate(token.offset);
+            out << "Line " << line << ", Column " << column << ": "
+                << tokenTypeName(token.type) << " = " << text(token) << '\n';
+        }
+    }
+
+    void writeTokens(JsonWriter& json) const {
+        CompileStats::Scope timed = phase("listing");
+        json.key("tokens").beginArray();
+        for (const Token& token : tokens) {
+            auto [line, column] = locate(token.offset);
+            json.beginObject()
+                .key("type").value(tokenTypeName(token.type))
+                .key("value").value(text(token))
+                .key("line").value(line)
+                .key("column").value(column)
+                .endObject();
+        }
+        json.endArray();
+    }
+
+    // Checks declarations and uses in source order and resolves each to
+    // its slot. Every block is a scope, and a declaration takes effect
+    // after its initializer, so 'val x = x + 1;' in a block reads the
+    // outer x. The tree is walked with an explicit stack; an entry marked
+    // 'done' closes a block's scope or completes a declaration.
+    void semanticAnalysis(NodeId id) {
+        if (id == NO_NODE) return;
+        nodeSlots.resize(ast.nodes.size());
+        // A node ID with DONE set revisits that node after its children
+        const NodeId DONE = 1u << 31;
+        vector<NodeId> pending{id};
+        while (!pending.empty()) {
+            NodeId next = pending.back();
+            pending.pop_back();
+            if (next & DONE) {
+                next &= ~DONE;
+                const ASTNode& node = ast[next];
+                if (node.kind == NodeKind::Block) {
+                    symbols.exitScope();
+                } else {
+                    int slot = symbols.declare(node.symbol, SymbolTable::Kind::Variable, node.value.data() - source.data());
+                    nodeSlots[next] = slot < 0 ? symbols.lookup(node.symbol) : slot;
+                }
+                continue;
+            }
+            const ASTNode& node = ast[next];
+            if (node.kind == NodeKind::Block) {
+                symbols.enterScope();
+                pending.push_back(next | DONE);
+            } else if (node.kind == NodeKind::Declaration) {
+                if (symbols.declaredInScope(node.symbol)) {
+                    semanticError(node, "Variable '" + string(node.value) + "' already declared.");
+                }
+                pending.push_back(next | DONE);
+            } else if (node.kind == NodeKind::Identifier) {
+                int slot = symbols.lookup(node.symbol);
+                if (slot < 0) {
+                    semanticError(node, "Undeclared variable '" + string(node.value) + "'");
+                }
+                nodeSlots[next] = slot;
+            }
+            for (uint32_t i = node.childCount; i-- > 0;) pending.push_back(ast.child(next, i));
+        }
+    }
+
+    // Reports an error at the name 'node' carries
+    void semanticError(const ASTNode& node, string message) {
+        uint32_t offset = node.value.data() - source.data();
+        auto [line, column] = locate(offset);
+        errors.push_back({"semantic", move(message), offset, (uint32_t)node.value.size(), line, column});
+    }
+
+    // Lists errors[begin, end), if there are any
+    void printErrors(ostream& out, size_t begin, size_t end) const {
+        if (begin == end) return;
+        out << "\nCompilation errors:\n";
+        for (size_t i = begin; i < end; ++i) {
+            out << errors[i].format() << '\n';
+        }
+    }
+};
+
+// --- Batch mode ---
+// Compiles every file on its own compiler instance and output buffers,
+// then prints the results in input order as soon as each one is ready.
+int runBatch(const vector<string>& files, size_t jobs, const CompileOptions& options, CompileCache& cache) {
+    struct Result {
+        string out, err;
+        int status = 0;
+        bool done = false;
+    };
+    vector<Result> results(files.size());
+    mutex doneLock;
+    condition_variable doneSignal;
+    int exitCode = 0;
+    size_t failed = 0;
+
+    WorkStealingPool pool(jobs);
+    for (size_t i = 0; i < files.size(); ++i) {
+        pool.submit([&, i] {
+            MukkuCompiler compiler(options);
+            compiler.setCache(&cache);
+            ostringstream out, err;
+            int status = compiler.compile(files[i], out, err);
+            {
+                lock_guard<mutex> guard(doneLock);
+                results[i].out = out.str();
+                results[i].err = err.str();
+                results[i].status = status;
+                results[i].done = true;
+            }
+            doneSignal.notify_all();
+        });
+    }
+
+    for (size_t i = 0; i < files.size(); ++i) {
+        Result result;
+        {
+            unique_lock<mutex> guard(doneLock);
+            doneSignal.wait(guard, [&] { return results[i].done; });
+            result = move(results[i]);
+        }
+        cout << "=== File: " << files[i] << " (exit " << result.status << ") ===\n";
+        cout << result.out;
+        cerr << result.err;
+        if (result.status != 0) {
+            exitCode = 1;
+            ++failed;
+        }
+    }
+    cout.flush();
+    cerr << "Batch: " << files.size() << " files, " << failed << " failed, "
+         << pool.size() << " threads, cache " << cache.statsJson() << endl;
+    return exitCode;
+}
+
+// Collects batch inputs; '@list.txt' names a manifest with one path per line
+static bool collectBatchFiles(const vector<string>& args, size_t first, vector<string>& files, size_t& jobs) {
+    for (size_t i = first; i < args.size(); ++i) {
+        const string& arg = args[i];
+        if (arg == "--jobs" && i + 1 < args.size()) {
+            jobs = strtoul(args[++i].c_str(), nullptr, 10);
+        } else if (arg.size() > 1 && arg[0] == '@') {
+            ifstream manifest(arg.substr(1));
+            if (!manifest.is_open()) {
+                cerr << "Error: Could not open manifest '" << arg.substr(1) << "'" << endl;
+                return false;
+            }
+            string line;
+            while (getline(manifest, line)) {
+                if (!line.empty() && line.back() == '\r') line.pop_back();
+                if (!line.empty()) files.push_back(line);
+            }
+        } else {
+            files.push_back(arg);
+        }
+    }
+    return true;
+}
+
+// --- Benchmarks ---
+// Synthetic programs of several shapes and sizes are compiled on the VM
+// backend with instrumentation on and all output discarded. A phase's
+// throughput is the items it handled per second of the compiling thread's
+// CPU time in its median run, which other load on the machine disturbs far
+// less than wall time. Results can be saved as a baseline that later runs
+// are gated against. Gating compares each phase's time relative to a fixed
+// calibration loop timed just before it in the same process, so a machine
+// that runs slower today does not read as a regression.
+
+struct BenchOptions {
+    vector<size_t> sizes = {10000, 100000, 1000000};  // tokens per program
+    size_t repeat = 9;
+    string baselinePath;          // compare against this baseline
+    string savePath;              // write the results as a baseline
+    double tolerance = 0.25;      // throughput drop that counts as a regression
+};
+
+// A phase, the stat its throughput counts and that stat's unit
+struct BenchPhase {
+    const char* name;
+    size_t CompileStats::*items;
+    const char* unit;
+};
+
+static const BenchPhase BENCH_PHASES[] = {
+    {"lex", &CompileStats::tokens, "tokens"},
+    {"parse", &CompileStats::astNodes, "nodes"},
+    {"semantic", &CompileStats::astNodes, "nodes"},
+    {"tac", &CompileStats::tacInstructions, "tac"},
+    {"optimize", &CompileStats::tacInstructions, "tac"},
+    {"codegen", &CompileStats::storageSlots, "slots"},
+    {"run", &CompileStats::vmInstructions, "ops"},
+};
+
+static const char* const BENCH_WORKLOADS[] = {"declarations", "expressions", "branches", "identifiers"};
+
+static void appendBranches(string& code, const string& name, int depth, size_t& tokens) {
+    if (depth == 0) {
+        code += "prt(" + name + ");\n";
+        tokens += 5;
+        return;
+    }
+    code += "agar (" + name + " < " + to_string(depth * 10) + ") {\n";
+    appendBranches(code, name, depth - 1, tokens);
+    code += "} nhi-to {\n";
+    appendBranches(code, name, depth - 1, tokens);
+    code += "}\n";
+    tokens += 10;
+}
+
+// A valid program of about 'tokens' tokens in one workload shape
+static string generateWorkload(string_view kind, size_t tokens) {
+    string code;
+    size_t count = 0, i = 0;
+    if (kind == "declarations") {
+        // One long dependency chain
+        code += "val d0 = 1;\n";
+        for (i = 1, count = 5; count < tokens; ++i, count += 7) {
+            code += "val d" + to_string(i) + " = d" + to_string(i - 1) + " + " + to_string(i % 10) + ";\n";
+        }
+        code += "prt(d" + to_string(i - 1) + ");\n";
+    } else if (kind == "expressions") {
+        // 64-operator chains mixing precedences, each one deep tree
+        static const char* const ops[] = {" + ", " * ", " - ", " * "};
+        code += "val e0 = 1;\n";
+        for (i = 1, count = 5; count < tokens; ++i, count += 133) {
+            string previous = "e" + to_string(i - 1);
+            code += "val e" + to_string(i) + " = " + previous;
+            for (int k = 0; k < 64; ++k) code += ops[k % 4] + (k % 5 == 0 ? previous : to_string(k % 7 + 1));
+            code += ";\n";
+        }
+        code += "prt(e" + to_string(i - 1) + ");\n";
+    } else if (kind == "branches") {
+        // agar/nhi-to nested four deep, side by side
+        for (i = 0; count < tokens; ++i) {
+            string name = "b" + to_string(i);
+            code += "val " + name + " = " + to_string(i % 50) + ";\n";
+            count += 5;
+            appendBranches(code, name, 4, count);
+        }
+    } else if (kind == "identifiers") {
+        // Every declaration introduces a new long name
+        for (i = 0; count < tokens; ++i, count += 5) {
+            char name[48];
+            snprintf(name, sizeof(name), "id_%016llx_%zu", (unsigned long long)mix64(i + 1), i);
+            code += string("val ") + name + " = " + to_string(i % 1000) + ";\n";
+            if (i % 64 == 63) {
+                code += string("prt(") + name + ");\n";
+                count += 5;
+            }
+        }
+    }
+    return code;
+}
+
+struct BenchResult {
+    string workload;
+    size_t size;
+    const BenchPhase* phase;
+    size_t items;
+    double millis;                // CPU time, median of the repeats
+    double loops;                 // the same in calibration loops, median of the repeats
+
+    string key() const { return workload + " " + to_string(size) + " " + phase->name; }
+    double perSecond() const { return millis > 0 ? items / (millis / 1e3) : 0; }
+    double perLoop() const { return loops > 0 ? items / loops : 0; }
+};
+
+// Baseline lines are "workload size phase items-per-calibration-loop"
+static bool readBenchBaseline(const string& path, map<string, double>& baseline) {
+    ifstream in(path);
+    if (!in.is_open()) return false;
+    string workload, size, phase;
+    double perLoop;
+    while (in >> workload >> size >> phase >> perLoop) baseline[workload + " " + size + " " + phase] = perLoop;
+    return true;
+}
+
+static bool writeBenchBaseline(const string& path, const vector<BenchResult>& results) {
+    ofstream out(path);
+    char line[128];
+    for (const BenchResult& result : results) {
+        snprintf(line, sizeof(line), "%s %.6g\n", result.key().c_str(), result.perLoop());
+        out << line;
+    }
+    return (bool)out;
+}
+
+static double medianOf(vector<double> samples) {
+    sort(samples.begin(), samples.end());
+    size_t middle = samples.size() / 2;
+    return samples.size() % 2 ? samples[middle] : (samples[middle - 1] + samples[middle]) / 2;
+}
+
+// Keeps the calibration loop from being optimized away
+volatile uint32_t benchSink;
+
+// CPU time of a fixed integer workload shaped like the compiler's own:
+// hashing, table probes and branches
+static double calibrationMillis() {
+    vector<uint32_t> table(1 << 16);
+    uint64_t state = 1;
+    double start = threadCpuMicros();
+    for (uint32_t i = 0; i < 1000000; ++i) {
+        state = mix64(state + i);
+        uint32_t& slot = table[state & (table.size() - 1)];
+        slot = (state >> 40) & 1 ? slot + i : slot ^ (uint32_t)state;
+    }
+    double millis = (threadCpuMicros() - start) / 1e3;
+    benchSink = table[state & (table.size() - 1)];
+    return millis;
+}
+
+static int runBenchmarks(CompileOptions options, const BenchOptions& bench) {
+    options.format = OutputFormat::Text;
+    options.jit = false;                // the VM counts the operations it runs
+    if (options.parseThreads == 0) options.parseThreads = 1;  // keep parsing on the timed thread
+    options.stats = true;
+    options.objectPath.clear();
+    options.tracePath.clear();
+    ostream discard(nullptr);
+    MukkuCompiler compiler(options);
+
+    map<string, double> baseline;
+    if (!bench.baselinePath.empty() && !readBenchBaseline(bench.baselinePath, baseline)) {
+        cerr << "Error: Could not open baseline '" << bench.baselinePath << "'" << endl;
+        return 1;
+    }
+
+    // Phases shorter than this are too noisy to gate on
+    const double noiseFloorMillis = 10.0;
+    vector<BenchResult> results;
+    size_t repeat = max<size_t>(bench.repeat, 1);
+    size_t regressions = 0;
+    char line[256];
+    snprintf(line, sizeof(line), "%-13s %8s  %-9s %10s %-7s %10s %12s  %s\n", "workload", "tokens", "phase",
+             "items", "", "cpu ms", "items/s", "vs baseline");
+    cout << line;
+    for (const char* workload : BENCH_WORKLOADS) {
+        for (size_t tokens : bench.sizes) {
+            string code = generateWorkload(workload, tokens);
+            // The first compilation warms the heap and caches and isn't counted
+            compiler.compileSource(code, discard, discard);
+            if (compiler.lastStats().vmInstructions == 0) {
+                cerr << "Error: " << workload << " workload of " << tokens << " tokens did not compile" << endl;
+                return 1;
+            }
+            size_t first = results.size();
+            vector<vector<double>> millis(size(BENCH_PHASES)), loops(size(BENCH_PHASES));
+            for (size_t run = 0; run < repeat; ++run) {
+                double calibration = calibrationMillis();
+                compiler.compileSource(code, discard, discard);
+                const CompileStats& stats = compiler.lastStats();
+                for (size_t k = 0; k < size(BENCH_PHASES); ++k) {
+                    double phaseMillis = 0;
+                    for (const PhaseRecord& phase : stats.phases) {
+                        if (strcmp(phase.name, BENCH_PHASES[k].name) == 0) phaseMillis += phase.cpuMicros / 1e3;
+                    }
+                    millis[k].push_back(phaseMillis);
+                    loops[k].push_back(phaseMillis / calibration);
+                    if (run == 0) {
+                        results.push_back({workload, tokens, &BENCH_PHASES[k], stats.*BENCH_PHASES[k].items, 0, 0});
+                    }
+                }
+            }
+            for (size_t k = 0; k < size(BENCH_PHASES); ++k) {
+                results[first + k].millis = medianOf(millis[k]);
+                results[first + k].loops = medianOf(loops[k]);
+            }
+
+            for (size_t k = first; k < results.size(); ++k) {
+                const BenchResult& result = results[k];
+                string verdict;
+                auto it = baseline.find(result.key());
+                if (it != baseline.end() && it->second > 0) {
+                    double change = result.perLoop() / it->second - 1;
+                    char percent[32];
+                    snprintf(percent, sizeof(percent), "%+.1f%%", change * 100);
+                    verdict = percent;
+                    if (change < -bench.tolerance && result.millis >= noiseFloorMillis) {
+                        verdict += "  REGRESSION";
+                        ++regressions;
+                    }
+                }
+                snprintf(line, sizeof(line), "%-13s %8zu  %-9s %10zu %-7s %10.3f %12.4g  %s\n", workload, tokens,
+                         result.phase->name, result.items, result.phase->unit, result.millis, result.perSecond(),
+                         verdict.c_str());
+                cout << line;
+            }
+        }
+    }
+
+    // Throughput should not fall with size; a phase that slows down on
+    // bigger inputs is doing superlinear work
+    size_t perWorkload = bench.sizes.size() * size(BENCH_PHASES);
+    for (size_t w = 0; bench.sizes.size() > 1 && w < size(BENCH_WORKLOADS); ++w) {
+        for (size_t k = 0; k < size(BENCH_PHASES); ++k) {
+            const BenchResult& small = results[w * perWorkload + k];
+            const BenchResult& large = results[w * perWorkload + perWorkload - size(BENCH_PHASES) + k];
+            if (large.millis < noiseFloorMillis || large.perSecond() >= 0.5 * small.perSecond()) continue;
+            snprintf(line, sizeof(line), "note: %s on %s runs at %.0f%% of its %zu-token throughput at %zu tokens\n",
+                     large.phase->name, large.workload.c_str(), 100 * large.perSecond() / small.perSecond(),
+                     small.size, large.size);
+            cout << line;
+        }
+    }
+
+    if (!bench.savePath.empty() && !writeBenchBaseline(bench.savePath, results)) {
+        cerr << "Error: Could not write baseline '" << bench.savePath << "'" << endl;
+        return 1;
+    }
+    if (!bench.baselinePath.empty()) {
+        cout << regressions << " regression" << (regressions == 1 ? "" : "s") << " against " << bench.baselinePath
+             << " (tolerance " << bench.tolerance * 100 << "%)" << endl;
+    }
+    return regressions ? 1 : 0;
+}
+
+static bool parseBenchArgs(const vector<string>& args, size_t first, BenchOptions& bench) {
+    for (size_t i = first; i < args.size(); ++i) {
+        const string& arg = args[i];
+        bool hasValue = i + 1 < args.size();
+        if (arg == "--sizes" && hasValue) {
+            bench.sizes.clear();
+            stringstream list(args[++i]);
+            string size;
+            while (getline(list, size, ',')) {
+                size_t tokens = strtoul(size.c_str(), nullptr, 10);
+                if (tokens == 0) return false;
+                bench.sizes.push_back(tokens);
+            }
+        } else if (arg == "--repeat" && hasValue) {
+            bench.repeat = strtoul(args[++i].c_str(), nullptr, 10);
+        } else if (arg == "--baseline" && hasValue) {
+            bench.baselinePath = args[++i];
+        } else if (arg == "--save-baseline" && hasValue) {
+            bench.savePath = args[++i];
+        } else if (arg == "--tolerance" && hasValue) {
+            bench.tolerance = strtod(args[++i].c_str(), nullptr) / 100;
+        } else {
+            return false;
+        }
+    }
+    return !bench.sizes.empty();
+}
+
+// --- Worker mode ---
+// Frames are little-endian and every string is a u32 length followed by
+// its bytes. A request is an options string (space-separated flags such
+// as --format=json) and the source; a response is a u32 exit status
+// followed by the stdout and stderr strings.
+static bool readExact(FILE* in, char* buf, size_t n) {
+    return fread(buf, 1, n, in) == n;
+}
+
+static bool readU32(FILE* in, uint32_t& value) {
+    unsigned char b[4];
+    if (!readExact(in, (char*)b, 4)) return false;
+    value = b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+    return true;
+}
+
+static bool readBlob(FILE* in, string& s) {
+    uint32_t length;
+    if (!readU32(in, length)) return false;
+    s.resize(length);
+    return length == 0 || readExact(in, &s[0], length);
+}
+
+static void writeU32(FILE* out, uint32_t value) {
+    unsigned char b[4] = {(unsigned char)value, (unsigned char)(value >> 8),
+                          (unsigned char)(value >> 16), (unsigned char)(value >> 24)};
+    fwrite(b, 1, 4, out);
+}
+
+static void writeBlob(FILE* out, const string& s) {
+    writeU32(out, s.size());
+    fwrite(s.data(), 1, s.size(), out);
+}
+
+// Editor sessions of one serve process; the least recently used is
+// dropped when a new one would exceed the limit
+class SessionTable {
+    list<pair<string, unique_ptr<MukkuCompiler>>> sessions;   // most recent first
+    size_t limit;
+public:
+    explicit SessionTable(size_t maxSessions) : limit(maxSessions) {}
+
+    MukkuCompiler* find(const string& id) {
+        for (auto it = sessions.begin(); it != sessions.end(); ++it) {
+            if (it->first != id) continue;
+            sessions.splice(sessions.begin(), sessions, it);
+            return sessions.front().second.get();
+        }
+        return nullptr;
+    }
+
+    MukkuCompiler& open(const string& id) {
+        close(id);
+        sessions.emplace_front(id, make_unique<MukkuCompiler>());
+        if (sessions.size() > limit) sessions.pop_back();
+        return *sessions.front().second;
+    }
+
+    void close(const string& id) {
+        sessions.remove_if([&](const auto& session) { return session.first == id; });
+    }
+};
+
+// Parses '--edit=OFFSET,DELETED'
+bool parseEditFlag(string_view arg, size_t& offset, size_t& deleted) {
+    if (arg.substr(0, 7) != "--edit=") return false;
+    const char* end = arg.data() + arg.size();
+    auto [comma, ec] = from_chars(arg.data() + 7, end, offset);
+    if (ec != errc() || comma == end || *comma != ',') return false;
+    auto [last, ec2] = from_chars(comma + 1, end, deleted);
+    return ec2 == errc() && last == end;
+}
+
+// Serves compile requests over stdin/stdout until EOF, reusing one
+// compiler instance that is reset between requests. A request whose
+// flags are '--cache-stats' gets the cache counters back as JSON.
+//
+// '--session=ID' compiles through an editor session kept across
+// requests: the code replaces the session's source, or with
+// '--edit=OFFSET,DELETED' is inserted in place of DELETED bytes at
+// OFFSET. An edit to an unknown session, or one out of range, gets
+// status 2 and the client resends the whole source.
+int serve(CompileCache& cache) {
+    MukkuCompiler compiler;
+    compiler.setCache(&cache);
+    SessionTable sessions(16);
+    string flags, code;
+    while (readBlob(stdin, flags) && readBlob(stdin, code)) {
+        CompileOptions options;
+        istringstream flagStream(flags);
+        string flag, sessionId;
+        bool statsOnly = false, isEdit = false;
+        size_t editOffset = 0, editDeleted = 0;
+        while (flagStream >> flag) {
+            if (flag == "--cache-stats") statsOnly = true;
+            else if (flag.compare(0, 10, "--session=") == 0) sessionId = flag.substr(10);
+            else if (parseEditFlag(flag, editOffset, editDeleted)) isEdit = true;
+            else parseCompileOption(flag, options);
+        }
+        options.objectPath.clear();      // clients may not write files on this host
+
+        ostringstream out, err;
+        int status = 0;
+        if (statsOnly) {
+            out << cache.statsJson();
+        } else if (!sessionId.empty()) {
+            MukkuCompiler* session = isEdit ? sessions.find(sessionId) : &sessions.open(sessionId);
+            if (session && isEdit && !session->applyEdit(editOffset, editDeleted, code)) {
+                sessions.close(sessionId);
+                session = nullptr;
+            }
+            if (!session) {
+                err << "Error: session '" << sessionId << "' needs the full source" << endl;
+                status = 2;
+            } else {
+                session->setOptions(options);
+                session->setCache(&cache);
+                if (!isEdit) session->openSession(move(code));
+                status = session->compileCurrent(out, err);
+            }
+        } else {
+            compiler.setOptions(options);
+            status = compiler.compileSource(move(code), out, err);
+            compiler.reset();
+        }
+
+        writeU32(stdout, status);
+        writeBlob(stdout, out.str());
+        writeBlob(stdout, err.str());
+        fflush(stdout);
+        code = string();
+    }
+    return 0;
+}
+
+// --- HTTP mode ---
+// The /compile contract of server.py served straight from this process:
+// one epoll loop owns every socket and hands compile requests to a fixed
+// pool of worker threads through a bounded queue. When the queue is full,
+// the connection cap is reached or the process runs out of descriptors
+// the loop stops accepting, so overload waits in the kernel's listen
+// backlog instead of in memory. Connections are HTTP/1.1 keep-alive and
+// every response allows any origin, as flask_cors does.
+#ifdef MUKKU_HTTP
+
+struct HttpResponse {
+    int status = 200;
+    string contentType = "application/json";
+    string headers;               // extra header lines, each ending in \r\n
+    string body;
+};
+
+// {"output": ..., "type": ...} as server.py replies; a null type is left out
+static HttpResponse jsonReply(int status, string_view output, const char* type) {
+    ostringstream out;
+    JsonWriter json(out);
+    json.beginObject().key("output").value(output);
+    if (type) json.key("type").value(type);
+    json.endObject();
+    return {status, "application/json", "", out.str()};
+}
+
+static const char* httpReason(int status) {
+    switch (status) {
+        case 100: return "Continue";
+        case 200: return "OK";
+        case 204: return "No Content";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 409: return "Conflict";
+        case 413: return "Payload Too Large";
+        case 431: return "Request Header Fields Too Large";
+        case 501: return "Not Implemented";
+        case 505: return "HTTP Version Not Supported";
+        default: return "Internal Server Error";
+    }
+}
+
+// The request line and the headers this server acts on
+struct HttpRequest {
+    string method, target;
+    size_t headLength = 0;        // through the blank line
+    size_t contentLength = 0;
+    bool keepAlive = true;
+    bool expectContinue = false;
+};
+
+const size_t HTTP_MAX_HEAD = 16 << 10;
+const size_t HTTP_MAX_BODY = 16 << 20;
+
+static bool equalsIgnoreCase(string_view a, string_view b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (tolower((unsigned char)a[i]) != tolower((unsigned char)b[i])) return false;
+    }
+    return true;
+}
+
+static string_view trimSpace(string_view s) {
+    size_t first = s.find_first_not_of(" \t\r\n\f\v");
+    if (first == string_view::npos) return {};
+    return s.substr(first, s.find_last_not_of(" \t\r\n\f\v") - first + 1);
+}
+
+// Reads the head of the request at the start of 'input'. Returns 0 while
+// the head is incomplete, 200 once 'request' is filled in, or the status
+// to reject the request with.
+static int parseHttpHead(string_view input, HttpRequest& request) {
+    size_t end = input.find("\r\n\r\n");
+    if (end == string_view::npos) return input.size() > HTTP_MAX_HEAD ? 431 : 0;
+    if (end > HTTP_MAX_HEAD) return 431;
+    request = HttpRequest();
+    request.headLength = end + 4;
+
+    string_view head = input.substr(0, end);
+    size_t lineEnd = head.find("\r\n");
+    string_view line = head.substr(0, lineEnd);
+    size_t space1 = line.find(' '), space2 = line.rfind(' ');
+    if (space1 == string_view::npos || space1 == space2) return 400;
+    request.method = string(line.substr(0, space1));
+    request.target = string(line.substr(space1 + 1, space2 - space1 - 1));
+    string_view version = line.substr(space2 + 1);
+    if (version == "HTTP/1.0") request.keepAlive = false;
+    else if (version != "HTTP/1.1") return version.substr(0, 5) == "HTTP/" ? 505 : 400;
+    if (request.method.empty() || request.target.empty() || request.target[0] != '/') return 400;
+
+    bool sawLength = false;
+    while (lineEnd != string_view::npos) {
+        size_t start = lineEnd + 2;
+        lineEnd = head.find("\r\n", start);
+        line = head.substr(start, lineEnd == string_view::npos ? string_view::npos : lineEnd - start);
+        size_t colon = line.find(':');
+        if (colon == string_view::npos || colon == 0) return 400;
+        string_view name = line.substr(0, colon), value = trimSpace(line.substr(colon + 1));
+        if (equalsIgnoreCase(name, "Content-Length")) {
+            size_t length = 0;
+            auto [last, ec] = from_chars(value.data(), value.data() + value.size(), length);
+            if (ec != errc() || last != value.data() + value.size() || value.empty()) return 400;
+            if (sawLength && length != request.contentLength) return 400;
+            request.contentLength = length;
+            sawLength = true;
+        } else if (equalsIgnoreCase(name, "Transfer-Encoding")) {
+            if (!equalsIgnoreCase(value, "identity")) return 501;
+        } else if (equalsIgnoreCase(name, "Connection")) {
+            for (string_view options = value; !options.empty();) {
+                size_t comma = options.find(',');
+                string_view option = trimSpace(options.substr(0, comma));
+                if (equalsIgnoreCase(option, "close")) request.keepAlive = false;
+                else if (equalsIgnoreCase(option, "keep-alive")) request.keepAlive = true;
+                options = comma == string_view::npos ? string_view() : options.substr(comma + 1);
+            }
+        } else if (equalsIgnoreCase(name, "Expect")) {
+            if (!equalsIgnoreCase(value, "100-continue")) return 400;
+            request.expectContinue = true;
+        }
+    }
+    return request.contentLength > HTTP_MAX_BODY ? 413 : 200;
+}
+
+// Editor sessions shared by the HTTP workers. Each is used by one request
+// at a time; the least recently used is dropped past the limit.
+class SharedSessionTable {
+public:
+    struct Session {
+        mutex lock;
+        MukkuCompiler compiler;
+    };
+
+    explicit SharedSessionTable(size_t maxSessions) : limit(maxSessions) {}
+
+    shared_ptr<Session> find(const string& id) {
+        lock_guard<mutex> guard(lock);
+        for (auto it = sessions.begin(); it != sessions.end(); ++it) {
+            if (it->first != id) continue;
+            sessions.splice(sessions.begin(), sessions, it);
+            return sessions.front().second;
+        }
+        return nullptr;
+    }
+
+    // Replaces session 'id' with a new one that comes back locked, so
+    // edits to it wait until its text is in
+    shared_ptr<Session> open(const string& id) {
+        auto session = make_shared<Session>();
+        session->lock.lock();
+        lock_guard<mutex> guard(lock);
+        sessions.remove_if([&](const auto& entry) { return entry.first == id; });
+        sessions.emplace_front(id, session);
+        if (sessions.size() > limit) sessions.pop_back();
+        return session;
+    }
+
+    // Drops 'session' unless 'id' has been reopened since
+    void close(const string& id, const shared_ptr<Session>& session) {
+        lock_guard<mutex> guard(lock);
+        sessions.remove_if([&](const auto& entry) { return entry.first == id && entry.second == session; });
+    }
+
+private:
+    mutex lock;
+    list<pair<string, shared_ptr<Session>>> sessions;   // most recent first
+    size_t limit;
+};
+
+struct HttpOptions {
+    uint16_t port = 5000;
+    size_t workers = max(1u, thread::hardware_concurrency());
+    size_t queueLimit = 256;      // compile requests waiting for a worker
+    size_t maxConnections = 1024; // open client connections
+};
+
+static volatile sig_atomic_t httpStopRequested = 0;
+
+static void requestHttpStop(int) { httpStopRequested = 1; }
+
+class HttpServer {
+public:
+    HttpServer(const CompileOptions& options, CompileCache& c, const HttpOptions& settings)
+        : baseOptions(options), cache(c), config(settings), sessions(256) {}
+
+    // Serves until SIGINT or SIGTERM; returns the exit status
+    int run() {
+        if (!listenOn(config.port)) return 1;
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (epollFd < 0 || wakeFd < 0) {
+            cerr << "Error: " << strerror(errno) << endl;
+            return 1;
+        }
+        watch(LISTENER, listenFd, EPOLLIN);
+        watch(WAKEUP, wakeFd, EPOLLIN);
+
+        struct sigaction stop = {};
+        stop.sa_handler = requestHttpStop;
+        sigaction(SIGINT, &stop, nullptr);
+        sigaction(SIGTERM, &stop, nullptr);
+        signal(SIGPIPE, SIG_IGN);
+
+        for (size_t i = 0; i < config.workers; ++i) threads.emplace_back([this] { workerLoop(); });
+        cerr << "Listening on port " << config.port << " with " << config.workers << " workers" << endl;
+
+        epoll_event events[64];
+        auto lastSweep = chrono::steady_clock::now();
+        while (!httpStopRequested) {
+            int ready = epoll_wait(epollFd, events, 64, 1000);
+            if (ready < 0 && errno != EINTR) {
+                cerr << "Error: " << strerror(errno) << endl;
+                break;
+            }
+            for (int i = 0; i < ready; ++i) {
+                uint64_t id = events[i].data.u64;
+                if (id == LISTENER) acceptConnections();
+                else if (id == WAKEUP) collectResults();
+                else handleEvents(id, events[i].events);
+            }
+            auto now = chrono::steady_clock::now();
+            if (now - lastSweep >= chrono::seconds(1)) {
+                closeIdle(now);
+                // Descriptors held elsewhere may have been freed meanwhile
+                outOfDescriptors = false;
+                resumeAccepting();
+                lastSweep = now;
+            }
+        }
+        shutDown();
+        return 0;
+    }
+
+private:
+    // A client socket. Requests are handled one at a time, in order; the
+    // next is read only once the previous response has been sent.
+    struct Connection {
+        int fd = -1;
+        string input;             // received; handled up to 'consumed'
+        size_t consumed = 0;
+        string output;            // not yet sent, from 'sent' on
+        size_t sent = 0;
+        uint32_t events = 0;      // epoll interest
+        bool busy = false;        // a compile job is out for it
+        bool keepAlive = true;    // of the request being answered
+        bool closing = false;     // close once the output is sent
+        bool peerClosed = false;  // no more input will come
+        bool sentContinue = false;
+        chrono::steady_clock::time_point lastActive;
+    };
+
+    struct Job {
+        uint64_t connection;
+        string body;
+    };
+
+    struct Done {
+        uint64_t connection;
+        HttpResponse response;
+    };
+
+    // epoll ids below FIRST_CONNECTION are the server's own descriptors
+    static const uint64_t LISTENER = 0, WAKEUP = 1, FIRST_CONNECTION = 2;
+    static constexpr chrono::seconds IDLE_TIMEOUT{60};
+
+    CompileOptions baseOptions;
+    CompileCache& cache;
+    HttpOptions config;
+    SharedSessionTable sessions;
+
+    int listenFd = -1, epollFd = -1, wakeFd = -1;
+    bool accepting = true;        // the listener is in the epoll set
+    bool outOfDescriptors = false; // accept failed with EMFILE or ENFILE
+    unordered_map<uint64_t, Connection> connections;
+    uint64_t nextId = FIRST_CONNECTION;
+    deque<Job> waiting;           // jobs the full queue turned away
+
+    // Shared with the workers
+    mutex lock;
+    condition_variable jobReady;
+    deque<Job> jobs;
+    deque<Done> finished;
+    bool stopping = false;
+    vector<thread> threads;
+
+    bool listenOn(uint16_t port) {
+        listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        int on = 1;
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_ANY);
+        address.sin_port = htons(port);
+        if (listenFd < 0 || setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0 ||
+            ::bind(listenFd, (sockaddr*)&address, sizeof(address)) < 0 || listen(listenFd, SOMAXCONN) < 0) {
+            cerr << "Error: Could not listen on port " << port << ": " << strerror(errno) << endl;
+            return false;
+        }
+        return true;
+    }
+
+    void watch(uint64_t id, int fd, uint32_t events) {
+        epoll_event event = {};
+        event.events = events;
+        event.data.u64 = id;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+    }
+
+    // Reads while the connection is idle and waits to write while output
+    // is pending; errors and hangups are reported either way
+    void updateInterest(uint64_t id, Connection& c) {
+        uint32_t events = !c.output.empty() ? EPOLLOUT : c.busy ? 0u : EPOLLIN;
+        if (events == c.events) return;
+        c.events = events;
+        epoll_event event = {};
+        event.events = events;
+        event.data.u64 = id;
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, c.fd, &event);
+    }
+
+    // The listener is level-triggered, so whenever a connection can't be
+    // taken it leaves the epoll set rather than waking the loop again
+    void acceptConnections() {
+        while (true) {
+            if (connections.size() >= config.maxConnections) {
+                pauseAccepting();
+                return;
+            }
+            int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0 && (errno == EINTR || errno == ECONNABORTED)) continue;
+            if (fd < 0 && (errno == EMFILE || errno == ENFILE)) {
+                outOfDescriptors = true;
+                pauseAccepting();
+            }
+            if (fd < 0) return;
+            int on = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            uint64_t id = nextId++;
+            Connection& c = connections[id];
+            c.fd = fd;
+            c.events = EPOLLIN;
+            c.lastActive = chrono::steady_clock::now();
+            watch(id, fd, EPOLLIN);
+        }
+    }
+
+    void closeConnection(uint64_t id) {
+        auto it = connections.find(id);
+        if (it == connections.end()) return;
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, it->second.fd, nullptr);
+        close(it->second.fd);
+        connections.erase(it);
+        outOfDescriptors = false;
+        resumeAccepting();
+    }
+
+    void pauseAccepting() {
+        if (!accepting) return;
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, listenFd, nullptr);
+        accepting = false;
+    }
+
+    // Accepts again once nothing is holding it back
+    void resumeAccepting() {
+        if (accepting || !waiting.empty() || outOfDescriptors || connections.size() >= config.maxConnections) return;
+        watch(LISTENER, listenFd, EPOLLIN);
+        accepting = true;
+    }
+
+    void closeIdle(chrono::steady_clock::time_point now) {
+        vector<uint64_t> idle;
+        for (const auto& [id, c] : connections) {
+            if (!c.busy && now - c.lastActive > IDLE_TIMEOUT) idle.push_back(id);
+        }
+        for (uint64_t id : idle) closeConnection(id);
+    }
+
+    void handleEvents(uint64_t id, uint32_t events) {
+        auto it = connections.find(id);
+        if (it == connections.end()) return;
+        Connection& c = it->second;
+        if (events & (EPOLLERR | EPOLLHUP)) {
+            closeConnection(id);
+            return;
+        }
+        if (events & EPOLLOUT) {
+            flush(id, c);
+            drainInput(id);
+            return;
+        }
+        if (!(events & EPOLLIN)) return;
+
+        c.input.erase(0, c.consumed);
+        c.consumed = 0;
+        char buffer[64 << 10];
+        while (c.input.size() <= HTTP_MAX_HEAD + HTTP_MAX_BODY) {
+            ssize_t n = recv(c.fd, buffer, sizeof(buffer), 0);
+            if (n > 0) {
+                c.input.append(buffer, n);
+                continue;
+            }
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            if (n < 0) {
+                closeConnection(id);
+                return;
+            }
+            // The peer is done sending; answer what it sent, then close
+            c.peerClosed = true;
+            break;
+        }
+        c.lastActive = chrono::steady_clock::now();
+        drainInput(id);
+    }
+
+    // Answers the complete requests buffered for 'id' in order, until one
+    // goes to a worker or a response can't be sent in full yet. A loop
+    // rather than a call from flush, so a long pipelined burst doesn't
+    // nest one call per request.
+    void drainInput(uint64_t id) {
+        auto it = connections.find(id);
+        while (it != connections.end() && handleInput(id, it->second)) it = connections.find(id);
+        if (it == connections.end()) return;
+        Connection& c = it->second;
+        // Handled requests are dropped in bulk, once they are most of the buffer
+        if (c.consumed > c.input.size() / 2) {
+            c.input.erase(0, c.consumed);
+            c.consumed = 0;
+        }
+        if (c.peerClosed && !c.busy && c.output.empty()) closeConnection(id);
+    }
+
+    // Starts on the next complete request in the input. Returns true if
+    // it took one, and the connection may then be closed.
+    bool handleInput(uint64_t id, Connection& c) {
+        if (c.busy || c.closing || !c.output.empty()) return false;
+        string_view input = string_view(c.input).substr(c.consumed);
+        HttpRequest request;
+        int status = parseHttpHead(input, request);
+        if (status == 0) return false;
+        if (status != 200) {
+            HttpResponse response = jsonReply(status, string("❌ Error: ") + httpReason(status), "error");
+            c.keepAlive = false;
+            respond(id, c, response);
+            return true;
+        }
+        if (input.size() < request.headLength + request.contentLength) {
+            if (request.expectContinue && !c.sentContinue) {
+                c.sentContinue = true;
+                c.output = "HTTP/1.1 100 Continue\r\n\r\n";
+                flush(id, c);
+            }
+            return false;
+        }
+        string body(input.substr(request.headLength, request.contentLength));
+        c.consumed += request.headLength + request.contentLength;
+        c.sentContinue = false;
+        c.keepAlive = request.keepAlive && !c.peerClosed;
+        route(id, c, request, move(body));
+        return true;
+    }
+
+    void route(uint64_t id, Connection& c, const HttpRequest& request, string body) {
+        string_view path = string_view(request.target).substr(0, request.target.find('?'));
+        const char* allow = path == "/" ? "GET, POST, OPTIONS" : path == "/compile" ? "POST, OPTIONS"
+                          : path == "/cache-stats" ? "GET, OPTIONS" : nullptr;
+        HttpResponse response;
+        if (!allow) {
+            response = jsonReply(404, "❌ Error: Not found", "error");
+        } else if (request.method == "OPTIONS") {
+            // CORS preflight for the JSON POST browsers send
+            response.status = 204;
+            response.contentType.clear();
+            response.headers = string("Access-Control-Allow-Methods: ") + allow + "\r\n"
+                               "Access-Control-Allow-Headers: Content-Type\r\n"
+                               "Access-Control-Max-Age: 86400\r\n";
+        } else if (request.method == "POST" && path != "/cache-stats") {
+            c.busy = true;
+            updateInterest(id, c);
+            submit({id, move(body)});
+            return;
+        } else if (request.method == "GET" && path == "/") {
+            response.contentType = "text/html; charset=utf-8";
+            response.body = "Mukku Compiler Backend is running.";
+        } else if (request.method == "GET" && path == "/cache-stats") {
+            response.body = cache.statsJson();
+        } else {
+            response = jsonReply(405, "❌ Error: Method not allowed", "error");
+            response.headers = string("Allow: ") + allow + "\r\n";
+        }
+        respond(id, c, response);
+    }
+
+    void respond(uint64_t id, Connection& c, const HttpResponse& response) {
+        if (!c.keepAlive) c.closing = true;
+        string& out = c.output;
+        out.clear();
+        c.sent = 0;
+        out += "HTTP/1.1 " + to_string(response.status) + " " + httpReason(response.status) + "\r\n";
+        if (!response.contentType.empty()) out += "Content-Type: " + response.contentType + "\r\n";
+        if (response.status != 204) out += "Content-Length: " + to_string(response.body.size()) + "\r\n";
+        out += "Access-Control-Allow-Origin: *\r\n";
+        out += response.headers;
+        out += c.keepAlive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+        out += response.body;
+        flush(id, c);
+    }
+
+    // Sends what the socket takes; once all is out the connection closes
+    // or waits for drainInput to start its next request
+    void flush(uint64_t id, Connection& c) {
+        while (c.sent < c.output.size()) {
+            ssize_t n = send(c.fd, c.output.data() + c.sent, c.output.size() - c.sent, MSG_NOSIGNAL);
+            if (n > 0) {
+                c.sent += n;
+                continue;
+            }
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                updateInterest(id, c);
+                return;
+            }
+            closeConnection(id);
+            return;
+        }
+        c.output.clear();
+        c.sent = 0;
+        c.lastActive = chrono::steady_clock::now();
+        if (c.closing) {
+            closeConnection(id);
+            return;
+        }
+        updateInterest(id, c);
+    }
+
+    // Queues 'job' for the workers; a full queue parks it and pauses
+    // accepting until the workers catch up
+    void submit(Job job) {
+        if (waiting.empty() && enqueue(job)) return;
+        waiting.push_back(move(job));
+        pauseAccepting();
+    }
+
+    bool enqueue(Job& job) {
+        {
+            lock_guard<mutex> guard(lock);
+            if (jobs.size() >= config.queueLimit) return false;
+            jobs.push_back(move(job));
+        }
+        jobReady.notify_one();
+        return true;
+    }
+
+    // Sends the responses the workers have finished and refills the queue
+    void collectResults() {
+        uint64_t count;
+        while (read(wakeFd, &count, sizeof(count)) > 0) {}
+        deque<Done> done;
+        {
+            lock_guard<mutex> guard(lock);
+            done.swap(finished);
+        }
+        for (Done& result : done) {
+            auto it = connections.find(result.connection);
+            if (it == connections.end()) continue;
+            it->second.busy = false;
+            respond(result.connection, it->second, result.response);
+            drainInput(result.connection);
+        }
+        while (!waiting.empty()) {
+            if (!connections.count(waiting.front().connection)) {
+                waiting.pop_front();
+                continue;
+            }
+            if (!enqueue(waiting.front())) break;
+            waiting.pop_front();
+        }
+        resumeAccepting();
+    }
+
+    // Sessionless requests reuse one compiler per worker
+    void workerLoop() {
+        MukkuCompiler compiler;
+        compiler.setCache(&cache);
+        while (true) {
+            Job job;
+            {
+                unique_lock<mutex> guard(lock);
+                jobReady.wait(guard, [this] { return stopping || !jobs.empty(); });
+                if (stopping) return;
+                job = move(jobs.front());
+                jobs.pop_front();
+            }
+            HttpResponse response = compileRequest(job.body, compiler);
+            {
+                lock_guard<mutex> guard(lock);
+                finished.push_back({job.connection, move(response)});
+            }
+            uint64_t one = 1;
+            ssize_t written = write(wakeFd, &one, sizeof(one));
+            (void)written;
+        }
+    }
+
+    // Answers a /compile body the way server.py does
+    HttpResponse compileRequest(string_view body, MukkuCompiler& compiler) {
+        JsonValue request;
+        if (!JsonReader::parse(body, request) || request.type != JsonValue::Type::Object) {
+            return jsonReply(400, "❌ Error: Invalid JSON request", "error");
+        }
+        CompileOptions options = baseOptions;
+        const JsonValue* format = request.find("format");
+        bool structured = format && format->isString() && format->text == "json";
+        if (structured) options.format = OutputFormat::Json;
+        // "phases": "ast" or "run" etc. computes and returns only those parts
+        const JsonValue* phases = request.find("phases");
+        if (phases && !phases->isNull()) {
+            if (!phases->isString() || phases->text.empty() ||
+                !parsePhasesFlag("--phases=" + phases->text, options.phases)) {
+                return jsonReply(400, "❌ Error: Invalid phases", "error");
             }
         }
-        else if (node->nodeType == "Identifier") {
-            if (symbolTable.find(node->value) == symbolTable.end()) {
-                errors.push_back("Undeclared variable '" + node->value + "'");
+
+        // Editors send "session" with the full code once, then "edit":
+        // {"offset", "deleted", "inserted"} in UTF-8 bytes per change
+        const JsonValue* sessionValue = request.find("session");
+        string sessionId;
+        if (sessionValue && !sessionValue->isNull()) {
+            bool valid = sessionValue->isString() && !sessionValue->text.empty() && sessionValue->text.size() <= 64;
+            for (char ch : sessionValue->isString() ? sessionValue->text : string()) {
+                valid = valid && (isalnum((unsigned char)ch) || ch == '_' || ch == '-');
             }
+            if (!valid) return jsonReply(400, "❌ Error: Invalid session id", "error");
+            sessionId = sessionValue->text;
         }
-        else if (node->nodeType == "BinaryExpr") {
-            semanticAnalysis(node->children[0].get());
-            semanticAnalysis(node->children[1].get());
+
+        ostringstream out, err;
+        int status;
+        const JsonValue* edit = request.find("edit");
+        if (!sessionId.empty() && edit) {
+            size_t offset, deleted;
+            string_view inserted;
+            if (!readEdit(*edit, offset, deleted, inserted)) return jsonReply(400, "❌ Error: Invalid edit", "error");
+            shared_ptr<SharedSessionTable::Session> session = sessions.find(sessionId);
+            unique_lock<mutex> hold;
+            if (session) hold = unique_lock<mutex>(session->lock);
+            if (session && !session->compiler.applyEdit(offset, deleted, inserted)) {
+                sessions.close(sessionId, session);
+                session = nullptr;
+            }
+            if (!session) return jsonReply(409, "❌ Error: Unknown session, resend the code", "resync");
+            session->compiler.setOptions(options);
+            session->compiler.setCache(&cache);
+            status = session->compiler.compileCurrent(out, err);
+        } else {
+            const JsonValue* codeValue = request.find("code");
+            string_view code = codeValue && codeValue->isString() ? string_view(codeValue->text) : string_view();
+            if (trimSpace(code).empty()) return jsonReply(400, "❌ Error: Empty code submitted", nullptr);
+            if (!sessionId.empty()) {
+                // Offsets of later edits refer to this exact text
+                shared_ptr<SharedSessionTable::Session> session = sessions.open(sessionId);
+                unique_lock<mutex> hold(session->lock, adopt_lock);
+                session->compiler.setOptions(options);
+                session->compiler.setCache(&cache);
+                session->compiler.openSession(string(code));
+                status = session->compiler.compileCurrent(out, err);
+            } else {
+                compiler.setOptions(options);
+                status = compiler.compileSource(string(trimSpace(code)), out, err);
+                compiler.reset();
+            }
         }
-        else if (node->nodeType == "Return") {
-            if (!node->children.empty())
-                semanticAnalysis(node->children[0].get());
+
+        string stdoutText = out.str(), stderrText = err.str();
+        if (structured && !stdoutText.empty()) {
+            ostringstream reply;
+            JsonWriter json(reply);
+            json.beginObject().key("result").raw(trimSpace(stdoutText))
+                .key("type").value(status == 0 ? "success" : "error").endObject();
+            return {status == 0 ? 200 : 400, "application/json", "", reply.str()};
         }
-         // === FIX: Add this else branch to handle all other node types ===
-    else {
-        for (const auto& child : node->children) {
-            semanticAnalysis(child.get());
+        if (status == LIMIT_EXCEEDED_STATUS) return jsonReply(400, "❌ Limit Exceeded:\n" + stderrText, "error");
+        if (status != 0) {
+            return jsonReply(400, "❌ Runtime Error (Code " + to_string(status) + "):\n" + stderrText, "error");
         }
+        return jsonReply(200, stdoutText, "success");
     }
-        
+
+    // {"offset": N, "deleted": N, "inserted": "..."} with byte counts
+    static bool readEdit(const JsonValue& edit, size_t& offset, size_t& deleted, string_view& inserted) {
+        if (edit.type != JsonValue::Type::Object) return false;
+        auto count = [](const JsonValue* value, size_t& result) {
+            if (!value || value->type != JsonValue::Type::Number) return false;
+            double number = value->number;
+            if (number < 0 || number > 1e15 || number != (double)(size_t)number) return false;
+            result = (size_t)number;
+            return true;
+        };
+        if (!count(edit.find("offset"), offset) || !count(edit.find("deleted"), deleted)) return false;
+        const JsonValue* text = edit.find("inserted");
+        if (text && !text->isString()) return false;
+        inserted = text ? string_view(text->text) : string_view();
+        return true;
     }
 
-    void printErrors() const {
-        cout << "\nCompilation errors:" << endl;
-        for (const auto& error : errors) {
-            cout << error << endl;
+    // Lets running compilations finish and drops the queued ones
+    void shutDown() {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+            jobs.clear();
         }
+        jobReady.notify_all();
+        for (thread& worker : threads) worker.join();
+        vector<uint64_t> open;
+        for (const auto& entry : connections) open.push_back(entry.first);
+        for (uint64_t id : open) closeConnection(id);
+        close(listenFd);
+        close(wakeFd);
+        close(epollFd);
+        cerr << "Stopped" << endl;
     }
 };
 
+static bool parseHttpArgs(const vector<string>& args, size_t first, HttpOptions& http) {
+    if (const char* port = getenv("PORT")) http.port = (uint16_t)strtoul(port, nullptr, 10);
+    for (size_t i = first; i < args.size(); ++i) {
+        const string& arg = args[i];
+        if (i + 1 >= args.size()) return false;
+        unsigned long value = strtoul(args[++i].c_str(), nullptr, 10);
+        if (arg == "--port" && value > 0 && value <= 65535) http.port = (uint16_t)value;
+        else if (arg == "--workers" && value > 0 && value <= 1024) http.workers = value;
+        else if (arg == "--queue" && value > 0) http.queueLimit = value;
+        else if (arg == "--max-connections" && value > 0) http.maxConnections = value;
+        else return false;
+    }
+    return http.port != 0;
+}
+
+// Limits left unset on the command line get server.py's run limits
+static int serveHttp(CompileOptions options, CompileCache& cache, const HttpOptions& http) {
+    options.objectPath.clear();       // clients may not write files on this host
+    options.tracePath.clear();
+    options.stats = false;
+    ExecutionLimits& limits = options.limits;
+    if (!limits.instructions) limits.instructions = 50000000;
+    if (!limits.memoryBytes) limits.memoryBytes = 64 << 20;
+    if (!limits.outputBytes) limits.outputBytes = 1 << 20;
+    if (!limits.timeMillis) limits.timeMillis = 2000;
+    return HttpServer(options, cache, http).run();
+}
+
+#endif
+
 int main(int argc, char* argv[]) {
-    if (argc != 2) {
-        cerr << "Usage: " << argv[0] << " <filename.mukku>" << endl;
-        return 1;
+    ios::sync_with_stdio(false);
+
+    CompileOptions options;
+    CacheOptions cacheOptions;
+    vector<string> args;
+    for (int i = 1; i < argc; ++i) {
+        if (!parseCompileOption(argv[i], options) && !parseCacheOption(argv[i], cacheOptions)) {
+            args.push_back(argv[i]);
+        }
     }
 
-    MukkuCompiler compiler;
-    compiler.compile(argv[1]);
+    // Long-running modes also keep recent results in memory
+    bool longRunning = !args.empty() && (args[0] == "--serve" || args[0] == "--batch" || args[0] == "--http");
+    if (longRunning) cacheOptions.memoryLimit = 64u << 20;
+    CompileCache cache(cacheOptions);
 
-    return 0;
+    if (args.size() == 1 && args[0] == "--serve") {
+        return serve(cache);
+    }
+    if (!args.empty() && args[0] == "--batch") {
+        vector<string> files;
+        size_t jobs = thread::hardware_concurrency();
+        if (!collectBatchFiles(args, 1, files, jobs)) return 1;
+        return runBatch(files, jobs, options, cache);
+    }
+    if (!args.empty() && args[0] == "--http") {
+#ifdef MUKKU_HTTP
+        HttpOptions http;
+        if (parseHttpArgs(args, 1, http)) return serveHttp(options, cache, http);
+        cerr << "Usage: " << argv[0] << " --http [--port N] [--workers N] [--queue N] [--max-connections N]" << endl;
+#else
+        cerr << "Error: HTTP mode needs Linux" << endl;
+#endif
+        return 1;
+    }
+    if (!args.empty() && args[0] == "--bench") {
+        BenchOptions bench;
+        if (parseBenchArgs(args, 1, bench)) return runBenchmarks(options, bench);
+        cerr << "Usage: " << argv[0] << " --bench [--sizes TOKENS,...] [--repeat N] [--baseline FILE]" << endl;
+        cerr << "       [--save-baseline FILE] [--tolerance PERCENT]" << endl;
+        return 1;
+    }
+    if (args.size() != 1) {
+        cerr << "Usage: " << argv[0] << " [--format=text|json] [--backend=jit|vm] [--emit-object=out.o] <filename.mukku|->" << endl;
+        cerr << "       " << argv[0] << " --serve" << endl;
+        cerr << "       " << argv[0] << " --http [--port N] [--workers N] [--queue N] [--max-connections N]" << endl;
+        cerr << "       " << argv[0] << " --batch [--format=text|json] [--jobs N] <file.mukku|@manifest>..." << endl;
+        cerr << "       " << argv[0] << " --bench [--sizes TOKENS,...] [--baseline FILE] [--save-baseline FILE]" << endl;
+        cerr << "Any mode takes --cache-dir=DIR [--cache-limit=MB] to reuse results across runs" << endl;
+        cerr << "and --parse-threads=N to parse large programs on N threads (0: all cores, 1: off)" << endl;
+        cerr << "--stats appends a JSON report of each phase's time and allocations to stderr;" << endl;
+        cerr << "--trace=FILE writes the same phases as Chrome trace events" << endl;
+        cerr << "--phases=source,tokens,ast,symbols,tac,optimized,assembly,run lists only those parts" << endl;
+        cerr << "and runs only the phases they need;" << endl;
+        cerr << "--max-instructions=N, --max-memory=BYTES, --max-output=BYTES and --time-limit=MS" << endl;
+        cerr << "stop the program with status " << LIMIT_EXCEEDED_STATUS << " once it goes past them" << endl;
+        return 1;
+    }
+
+    MukkuCompiler compiler(options);
+    if (cache.enabled()) compiler.setCache(&cache);
+    return compiler.compile(args[0]);
 }
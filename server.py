@@ -1,9 +1,16 @@
 from flask import Flask, request, jsonify
 from flask_cors import CORS
 import subprocess
+import json
 import os
-import tempfile
-import uuid
+import re
+import select
+import struct
+import threading
+import time
+import zlib
+from collections import OrderedDict
+from contextlib import contextmanager
 
 app = Flask(__name__)
 CORS(app)
@@ -12,57 +19,260 @@ CORS(app)
 COMPILER_EXE = "compiler"
 if not os.path.exists(COMPILER_EXE):
     compile_result = subprocess.run(
-        ["g++", "main.cpp", "-o", COMPILER_EXE],
+        ["g++", "-O2", "-std=c++17", "-pthread", "main.cpp", "-o", COMPILER_EXE],
         capture_output=True,
         text=True
     )
     if compile_result.returncode != 0:
         print(f"⚠️ COMPILER COMPILATION FAILED:\n{compile_result.stderr}")
 
+REQUEST_TIMEOUT = 10  # Backstop; the compiler stops runs at RUN_LIMITS first
+# Per-run instruction budget, register memory, output bytes and milliseconds
+RUN_LIMITS = os.environ.get(
+    "COMPILER_RUN_LIMITS",
+    "--max-instructions=50000000 --max-memory=67108864 --max-output=1048576 --time-limit=2000",
+)
+LIMIT_EXCEEDED = 3       # compiler status: the run went past one of RUN_LIMITS
+POOL_SIZE = int(os.environ.get("COMPILER_WORKERS", os.cpu_count() or 2))
+# Workers share an on-disk result cache; an empty value turns it off
+CACHE_DIR = os.environ.get("COMPILER_CACHE_DIR", ".mukku-cache")
+CACHE_LIMIT_MB = int(os.environ.get("COMPILER_CACHE_LIMIT_MB", 256))
+
+
+class WorkerTimeout(Exception):
+    pass
+
+
+class CompilerWorker:
+    """A long-lived `compiler --serve` process speaking length-prefixed frames."""
+
+    def __init__(self):
+        args = [f"./{COMPILER_EXE}", "--serve"]
+        if CACHE_DIR:
+            args += [f"--cache-dir={CACHE_DIR}", f"--cache-limit={CACHE_LIMIT_MB}"]
+        self.proc = subprocess.Popen(
+            args,
+            stdin=subprocess.PIPE,
+            stdout=subprocess.PIPE,
+        )
+
+    def alive(self):
+        return self.proc.poll() is None
+
+    def _read_exact(self, n, deadline):
+        fd = self.proc.stdout.fileno()
+        chunks = []
+        while n > 0:
+            remaining = deadline - time.monotonic()
+            if remaining <= 0 or not select.select([fd], [], [], remaining)[0]:
+                raise WorkerTimeout()
+            chunk = os.read(fd, n)
+            if not chunk:
+                raise EOFError("compiler worker exited")
+            chunks.append(chunk)
+            n -= len(chunk)
+        return b"".join(chunks)
+
+    def _read_u32(self, deadline):
+        return struct.unpack("<I", self._read_exact(4, deadline))[0]
+
+    def compile(self, code, timeout, flags=""):
+        if isinstance(code, str):
+            code = code.encode()
+        frame = b""
+        for part in (flags.encode(), code):
+            frame += struct.pack("<I", len(part)) + part
+        self.proc.stdin.write(frame)
+        self.proc.stdin.flush()
+
+        deadline = time.monotonic() + timeout
+        status = self._read_u32(deadline)
+        stdout = self._read_exact(self._read_u32(deadline), deadline)
+        stderr = self._read_exact(self._read_u32(deadline), deadline)
+        return status, stdout.decode(errors="replace"), stderr.decode(errors="replace")
+
+    def kill(self):
+        self.proc.kill()
+        self.proc.wait()
+
+
+class WorkerPool:
+    """Lends out workers. Editor sessions live inside one worker process,
+    so a session's requests wait for the worker it is pinned to."""
+
+    def __init__(self, size):
+        self.workers = [CompilerWorker() for _ in range(size)]
+        self.idle = set(range(size))
+        self.changed = threading.Condition()
+
+    def pinned(self, session):
+        return zlib.crc32(session.encode()) % len(self.workers)
+
+    def acquire(self, index=None):
+        with self.changed:
+            if index is None:
+                self.changed.wait_for(lambda: self.idle)
+                index = self.idle.pop()
+            else:
+                self.changed.wait_for(lambda: index in self.idle)
+                self.idle.remove(index)
+            return index, self.workers[index]
+
+    def release(self, index):
+        with self.changed:
+            # A hung or crashed worker is replaced rather than reused
+            if not self.workers[index].alive():
+                self.workers[index] = CompilerWorker()
+            self.idle.add(index)
+            self.changed.notify_all()
+
+    @contextmanager
+    def lend(self, index=None):
+        """Holds a free worker, or worker 'index', for several requests."""
+        index, worker = self.acquire(index)
+        try:
+            yield worker
+        finally:
+            self.release(index)
+
+    def run(self, code, flags="", index=None):
+        """Compiles on a free worker, or on worker 'index'."""
+        with self.lend(index) as worker:
+            return run_on(worker, code, flags)
+
+
+def run_on(worker, code, flags):
+    try:
+        return worker.compile(code, REQUEST_TIMEOUT, f"{RUN_LIMITS} {flags}")
+    except (EOFError, BrokenPipeError):
+        # The worker crashed on this input; report it like a failed run
+        return worker.proc.wait(), "", ""
+    except WorkerTimeout:
+        worker.kill()
+        raise
+
+
+workers = WorkerPool(POOL_SIZE)
+
+# Text of every open editor session, so a session can be reopened on a
+# restarted worker. Least recently used sessions are dropped first.
+MAX_SESSIONS = 256
+SESSION_RESYNC = 2       # compiler status: the session needs the full source
+SESSION_ID = re.compile(r"[A-Za-z0-9_-]{1,64}")
+PHASES = re.compile(r"[a-z]+(,[a-z]+)*")
+sessions = OrderedDict()
+sessions_lock = threading.Lock()
+
+
+def compile_session(session, flags, code=None, edit=None):
+    """Opens 'session' with 'code', or applies 'edit' to its text, and
+    compiles the result on the session's worker. Returns None when an
+    edit arrives for a session the server does not know."""
+    session_flag = f"{flags} --session={session}"
+    # Holding the worker keeps a session's edits in the order applied here
+    with workers.lend(workers.pinned(session)) as worker:
+        with sessions_lock:
+            if edit is None:
+                text = code.encode()
+            elif session not in sessions:
+                return None
+            else:
+                text = sessions[session]
+                offset, deleted = int(edit["offset"]), int(edit["deleted"])
+                inserted = edit.get("inserted", "").encode()
+                if not (0 <= offset <= len(text) and 0 <= deleted <= len(text) - offset):
+                    del sessions[session]
+                    return None
+                text = text[:offset] + inserted + text[offset + deleted:]
+            sessions[session] = text
+            sessions.move_to_end(session)
+            while len(sessions) > MAX_SESSIONS:
+                sessions.popitem(last=False)
+
+        if edit is not None:
+            result = run_on(worker, inserted, f"{session_flag} --edit={offset},{deleted}")
+            if result[0] != SESSION_RESYNC or not worker.alive():
+                return result
+        return run_on(worker, text, session_flag)
+
+
 @app.route('/')
 def home():
     return "Mukku Compiler Backend is running."
 
+@app.route('/cache-stats')
+def cache_stats():
+    """Sums the cache counters of every worker; waits for busy ones."""
+    totals = {}
+    try:
+        for index in range(POOL_SIZE):
+            _, stdout, _ = workers.run("", "--cache-stats", index)
+            for name, value in json.loads(stdout or "{}").items():
+                # Every worker sees the same directory, so its size isn't summed
+                totals[name] = value if name == "disk_bytes" else totals.get(name, 0) + value
+        return jsonify(totals)
+    except WorkerTimeout as e:
+        return jsonify({"output": f"❌ Server Error: {type(e).__name__}", "type": "error"}), 500
+
 @app.route('/compile', methods=['POST'])
 def compile_code():
     try:
         data = request.get_json()
-        code = data.get("code", "").strip()
-        
-        if not code:
-            return jsonify({"output": "❌ Error: Empty code submitted"}), 400
-            
-        # Create temp file
-        temp_dir = tempfile.mkdtemp()
-        input_path = os.path.join(temp_dir, f"input_{uuid.uuid4().hex}.mukku")
-        
-        with open(input_path, "w") as f:
-            f.write(code)
-        
-        # Run compiler
-        process = subprocess.run(
-            [f"./{COMPILER_EXE}", input_path],
-            capture_output=True,
-            text=True,
-            timeout=10  # Prevent infinite runs
-        )
-        
-        # Cleanup temp directory
-        os.remove(input_path)
-        os.rmdir(temp_dir)
-        
-        if process.returncode != 0:
+        # "format": "json" returns the phases as a structured document
+        structured = data.get("format") == "json"
+        flags = "--format=json" if structured else ""
+        # "phases": "ast" or "run" etc. computes and returns only those parts
+        phases = data.get("phases")
+        if phases is not None:
+            if not PHASES.fullmatch(str(phases)):
+                return jsonify({"output": "❌ Error: Invalid phases", "type": "error"}), 400
+            flags += f" --phases={phases}"
+
+        # Editors send "session" with the full code once, then "edit":
+        # {"offset", "deleted", "inserted"} in UTF-8 bytes per change
+        session = data.get("session")
+        if session is not None and not SESSION_ID.fullmatch(str(session)):
+            return jsonify({"output": "❌ Error: Invalid session id", "type": "error"}), 400
+        if session is not None and "edit" in data:
+            result = compile_session(str(session), flags, edit=data["edit"])
+            if result is None:
+                return jsonify({"output": "❌ Error: Unknown session, resend the code", "type": "resync"}), 409
+            status, stdout, stderr = result
+        else:
+            code = data.get("code", "")
+            if not code.strip():
+                return jsonify({"output": "❌ Error: Empty code submitted"}), 400
+            if session is not None:
+                # Offsets of later edits refer to this exact text
+                status, stdout, stderr = compile_session(str(session), flags, code=code)
+            else:
+                status, stdout, stderr = workers.run(code.strip(), flags)
+
+        if structured and stdout:
+            result = json.loads(stdout)
             return jsonify({
-                "output": f"❌ Runtime Error (Code {process.returncode}):\n{process.stderr}",
+                "result": result,
+                "type": "success" if status == 0 else "error"
+            }), 200 if status == 0 else 400
+
+        if status == LIMIT_EXCEEDED:
+            return jsonify({
+                "output": f"❌ Limit Exceeded:\n{stderr}",
                 "type": "error"
             }), 400
-            
+
+        if status != 0:
+            return jsonify({
+                "output": f"❌ Runtime Error (Code {status}):\n{stderr}",
+                "type": "error"
+            }), 400
+
         return jsonify({
-            "output": process.stdout,
+            "output": stdout,
             "type": "success"
         })
 
-    except subprocess.TimeoutExpired:
+    except WorkerTimeout:
         return jsonify({"output": "❌ Timeout: Code took too long to execute", "type": "error"}), 400
     except Exception as e:
         return jsonify({"output": f"❌ Server Error: {str(e)}", "type": "error"}), 500
@@ -70,4 +280,3 @@ def compile_code():
 if __name__ == "__main__":
     port = int(os.environ.get("PORT", 5000))
     app.run(host="0.0.0.0", port=port)
-